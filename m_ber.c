@@ -21,12 +21,102 @@
     - Modulo operation to bin timestamps within a 32ns window.
     - Sliding window algorithm to identify the 3ns window with the maximum count.
     - Guard bands applied between consecutive 1ns bins to discard erroneous data.
+    - External-memory merge sort (parallel run generation, loser-tree k-way merge) for captures larger than RAM.
+    - Bucket-ring reorder buffer that restores time order of locally out-of-order input in O(1) amortized time.
+    - Rollover unwrapping of narrow wrapping hardware counters into monotonic 64-bit timestamps.
+    - Per-time-slice BER/visibility series from a bounded pool of recycled slice histograms.
+    - Sliding-window live histogram built from a ring of per-sub-interval delta histograms.
+    - Exponentially-decaying histogram with lazy decay (global scale, periodic renormalization).
+    - Versioned binary histogram snapshots that can be merged with SIMD adds.
+    - Fingerprint-keyed on-disk analysis cache of histograms and prefix sums with LRU eviction.
+    - Incremental tail-append processing of growing captures (saved offset and histograms, optional inotify follow).
+    - Batch analysis of many captures on a work-stealing thread pool with large files split into chunks.
+    - Multi-process sharding of one capture by byte range with a shared-memory histogram reduction.
+    - NUMA-aware parallel ingest with node-bound threads, node-local histograms and a hierarchical reduction.
+    - Privatized histogram fill over interleaved sub-histograms to avoid serialized increments of hot bins.
+    - Tiered 16-bit histograms with a lazily allocated 64-bit carry table for the slice and live-window stages.
+    - Configurable histogram resolution with exact integer rebinning and a resolution-error estimate.
+    - Fixed-point fractional-picosecond timestamps with sub-ps histogram bins.
+    - Analytic (Wilson) and parallel multinomial-bootstrap confidence intervals for BER and visibility.
+    - Early-stopping block-sampled ingestion that reads only until BER reaches a target precision.
+    - Preview of a random sample of blocks with design-based error bounds.
+    - Sparse byte-offset sidecar index for fast timestamp-range queries.
+    - Columnar in-memory event store with block skipping for repeated channel/range queries.
+    - Unix-socket analysis daemon with a compact binary protocol, and a matching client.
+    - Two-channel coincidence counting and delay histograms by a single sorted merge.
+    - Heralded BER/visibility from signal events with a herald coincidence, joined in parallel.
+    - Parallel normalized g2(tau) correlation histograms by a sliding pointer merge.
 
   Usage:
     - Compile and run the program by providing a CSV file as input:
       Example:
+      gcc -O2 -pthread m_ber.c -lm
       ./a.out timestamps.csv
 
+    - Options (placed before or after the file name):
+      --sort                 Sort the capture out of core first (memory bounded by --sort-memory <MB>)
+      --sort-output <file>   Also write the ingested stream as 16-byte binary time tags
+      --reorder <ps>         Stream locally out-of-order input through a reorder buffer tolerating <ps> of disorder
+      --counter-bits <n>     Rebuild 64-bit timestamps from an n-bit wrapping counter
+      --overflow-channel <c> Count wraps from overflow records on channel c instead of backward jumps
+      --slice <ps>           Print Group,slice,start,events,BER1,V1,BER2,V2 for every <ps> of timestamp time
+      --live-window <ps>     Print Group,live,end,events,peak,BER1,V1,BER2,V2 over the last <ps>, every --live-step <ps>
+      --decay-half-life <ps> Print Group,decay,time,weight,peak,BER1,V1,BER2,V2 from a decaying histogram, every --live-step <ps>
+      --save-snapshot <file> Save the per-channel histograms as a binary snapshot; a snapshot can be given
+                             instead of the CSV to re-run the analysis without parsing
+      --merge-snapshots <f>  Sum all input snapshots into <f> (./a.out --merge-snapshots all.qh night1.qh night2.qh)
+      --sweep-guard-bands    Also run find_optimal_guard_bands()
+      --cache / --cache-dir <dir>  Cache histograms by input fingerprint so repeated runs skip ingestion
+                             (LRU-bounded by --cache-size <MB>)
+      --state <file>         Incremental mode for a growing CSV: parse only lines appended since the last run
+      --follow               With --state, keep running and print updated results whenever the file grows
+      --batch <files/globs>  Analyze many captures on a work-stealing thread pool (big files are split into
+                             64MB chunks); prints file,Group,BER1,V1,BER2,V2,events,seconds per file
+      --batch-list <file>    Read batch inputs from a file, one per line (- for stdin)
+      --processes <n>        Shard the input by byte range across n worker processes that fill
+                             histograms in POSIX shared memory; a failed range is run again
+      --numa                 Parallel ingest of a memory-mapped capture with --threads threads bound per NUMA
+                             node, node-local histograms, a two-level reduction and per-node throughput
+      --resolution <ps>      Analyze with <ps>-wide bins (a divisor of 1000): the histogram is rebinned exactly,
+                             snapshots and cache entries are built at that resolution, and an estimate of
+                             the resulting BER error is printed after the result
+      --subps <n>            Parse fractional picoseconds (e.g. 61226.375) in fixed point and analyze with n
+                             bins per ps instead of truncating to whole picoseconds
+      --confidence <level>   Print Wilson-score confidence intervals of BER1, V1, BER2 and V2 at <level>
+      --bootstrap <n>        Also print percentile intervals from n multinomial resamples of the window
+                             counts, on --threads threads (reproducible with --seed <n>)
+      --target-precision <w> Quick check: read 1MB blocks spread over the file (--sample-order strided or
+                             random) until BER1 and BER2 are known to +-w, and report the fraction read
+      --preview              Analyze a random sample of 16KB blocks (--preview-blocks <n>, default 256) and
+                             print error bounds of BER1, V1, BER2 and V2
+      --build-index          Write the sidecar index <filename>.qidx (an entry every --index-lines <n> lines,
+                             default 16384, with the byte offset and min/max timestamp) and exit
+      --time-range <a>:<b>   Analyze only timestamps in [a, b) ps, reading just the overlapping index blocks
+                             (the index is built on first use and rebuilt when the capture changes)
+      --store                Load the capture once into a columnar in-memory store and answer queries read
+                             from stdin, one per line: channels=<c>,<c> range=<a>:<b> guard=<ps> sweep
+      --daemon <socket>      Keep captures, histograms and prefix sums in memory and answer binary requests on
+                             a Unix socket with --threads workers
+      --daemon-memory <MB>   Evict the least recently used captures above this size (default 1024)
+      --connect <socket>     Send the analysis to the daemon (with --time-range, --channels <c,c> and
+                             --sweep-guard-bands) and print its rows
+      --coincidences <a>,<b> Count coincidences of channels a and b within --coincidence-window <ps> (default
+                             1000) in one merge pass over the time-ordered input, and print the histogram of
+                             t_b - t_a in --coincidence-bin <ps> bins (default 10; --coincidence-output <file>)
+      --herald <channel>     Heralded analysis: bin only signal events (other channels, or --channels <c,c>)
+                             with a herald within --herald-window <ps> (default 1000), streamed in parallel
+                             time chunks in bounded memory
+      --g2 <a>,<b>           Normalized g2(tau), tau = t_b - t_a, over --g2-range <min>:<max> (default
+                             -10000:10000) in --g2-bin <ps> bins (default 100, at most 1048576 bins), in
+                             parallel time chunks; rows go to stdout or --g2-output <file>. a and b must
+                             differ: the autocorrelation a,a is not supported
+      --benchmark-fill       Time the naive histogram fill against the privatized fill (2, 4 and 8
+                             sub-histograms) on clustered and uniform timestamps
+      --check-binomial       Compare the bootstrap's binomial draws with n*p and n*p*(1-p) for small n;
+                             exits with status 1 on a mismatch
+      --temp-dir <dir>       Directory for spilled runs (default $TMPDIR or /tmp)
+      --threads <n>          Worker threads (default: one per CPU)
+
     - CSV format:
       timestamp1, value1
       timestamp2, value2
@@ -45,9 +135,29 @@
   Decreasing the guard band (e.g., to 50ps) might allow more valid timestamps to be counted but could increase noise, negatively affecting BER.
 */
 
+#define _GNU_SOURCE // For pread, mkstemp and friends
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h> // For fmod
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__SSE2__)
+#include <immintrin.h> // SSE2/AVX2 histogram merges
+#endif
 
 #define WINDOW_SIZE 32000 // 32ns in picoseconds
 #define GUARD_BAND 100    // 100ps guard band
@@ -56,6 +166,36 @@
 #define MIN_GUARD_BAND 100 // Minimum guard band in ps
 #define GUARD_BAND_STEP 1 // Step size for guard bands
 
+#define CSV_BUFFER_SIZE (1 << 20)     // 1MB read buffer for the CSV reader
+#define TAG_BLOCK_SIZE 4096           // Time tags moved per call between pipeline stages
+#define DEFAULT_SORT_MEMORY_MB 256    // Default memory budget of the external sorter
+#define MIN_SORT_MEMORY_MB 1          // Smallest accepted memory budget
+#define MIN_MERGE_BUFFER (256 * 1024) // Smallest per-run read buffer before an extra merge pass is needed
+#define DEFAULT_LIVE_STEPS 10         // Sub-intervals per sliding live window
+#define PEAK_BLOCK 100                // Bins per block of the block sums used by the pruned peak search
+#define DEFAULT_CACHE_SIZE_MB 256     // Default size limit of the analysis cache
+#define DEFAULT_DAEMON_MEMORY_MB 1024 // Default memory limit of the captures kept by the daemon
+#define FRACTION_DIGITS 9             // Fractional-ps digits kept by the parser
+#define FRACTION_UNIT 1000000000      // time_tag.fraction units per ps
+#define MAX_SUBPS 1000                // Finest sub-ps binning (bins per ps)
+#define SAMPLE_ORDER_STRIDED 0        // Block orders of sampled ingestion
+#define SAMPLE_ORDER_RANDOM 1
+#define DEFAULT_PREVIEW_BLOCKS 256    // Blocks read by --preview
+#define DEFAULT_INDEX_LINES 16384     // Lines per entry of the sidecar index
+#define DEFAULT_COINCIDENCE_WINDOW 1000 // Coincidence window in ps
+#define MAX_COINCIDENCE_BINS (1 << 20) // Most coincidence delay bins
+#define DEFAULT_COINCIDENCE_BIN 10    // Coincidence delay histogram bin width in ps
+#define DEFAULT_G2_RANGE 10000        // Default g2 tau range is +- this many ps
+#define DEFAULT_G2_BIN 100            // Default g2 tau bin width in ps
+#define MAX_G2_BINS (1 << 20)         // Most g2 tau bins (every thread keeps its own histogram)
+
+// Function to map a timestamp to its histogram bin; negative timestamps wrap into [0, WINDOW_SIZE) too
+static inline int window_bin(int64_t timestamp)
+{
+  int bin = (int)(timestamp % WINDOW_SIZE);
+  return bin < 0 ? bin + WINDOW_SIZE : bin;
+}
+
 // Function to read timestamps from CSV, modulo them by 32000ps, and populate histogram
 void process_csv_and_create_histogram(const char *filename, int *histogram)
 {
@@ -83,186 +223,7390 @@ void process_csv_and_create_histogram(const char *filename, int *histogram)
   while (fscanf(file, "%lf,%lf", &timestamp, &second_column_value) == 2)
   {
     // Apply modulo-32000 to fit within 32ns window
-    int mod_timestamp = (int)(timestamp) % WINDOW_SIZE;
-
     // Increment the corresponding bin in the histogram
-    histogram[mod_timestamp]++;
+    histogram[window_bin((int64_t)timestamp)]++;
   }
 
   // Close the file
   fclose(file);
 }
 
-// Function to find max sum window and calculate BER1 and Visibility1
-double find_max_sum_window(int histogram[], int size, int window_size, double *BER1, double *V1)
+// One detection event in the binary time-tag format (16 bytes, native byte order)
+struct time_tag
 {
-  int max_sum = 0;
-  int current_sum = 0;
-  int start_index = 0;
+  int64_t timestamp; // Detection time in picoseconds (integer part, rounded down)
+  int32_t channel;   // Detector channel (second CSV column)
+  uint32_t fraction; // Sub-picosecond part in units of 1e-9 ps (0 for integer timestamps)
+};
 
-  if (window_size > size)
+// Pull-based producer of time tags shared by all streaming stages.
+// read() fills up to max_tags tags and returns how many it wrote; 0 means end of stream.
+struct tag_source
+{
+  size_t (*read)(void *context, struct time_tag *tags, size_t max_tags);
+  void *context;
+};
+
+// Buffered reader that turns "timestamp,channel" CSV lines into time tags
+struct csv_reader
+{
+  FILE *file;
+  char *buffer;
+  size_t length;          // Valid bytes in buffer
+  size_t position;        // First unparsed byte in buffer
+  int64_t buffer_offset;  // File offset of buffer[0]
+  int64_t end_offset;     // Lines starting at or after this offset are left to the next range
+  int eof;
+  int complete_lines_only; // Leave a final line without '\n' unread (the file is still being written)
+};
+
+// Function to write a whole buffer to a file descriptor
+void write_all(int fd, const void *data, size_t size)
+{
+  const char *bytes = data;
+  while (size > 0)
   {
-    return -1;
+    ssize_t written = write(fd, bytes, size);
+    if (written < 0)
+    {
+      printf("Error: Could not write %zu bytes\n", size);
+      exit(1);
+    }
+    bytes += written;
+    size -= written;
   }
+}
 
-  // Calculate the sum of the first window
-  for (int i = 0; i < window_size; i++)
+// Function to return the seconds elapsed on the monotonic clock since begin
+double seconds_since(const struct timespec *begin)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - begin->tv_sec) + (now.tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+// Function to add one histogram into another (dst[i] += src[i]), four or eight bins per instruction
+void add_histograms(int *dst, const int *src, size_t size)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i < (size & ~(size_t)7); i += 8)
   {
-    current_sum += histogram[i];
+    __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(dst + i)), _mm256_loadu_si256((const __m256i *)(src + i)));
+    _mm256_storeu_si256((__m256i *)(dst + i), sum);
+  }
+#elif defined(__SSE2__)
+  for (; i < (size & ~(size_t)3); i += 4)
+  {
+    __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(dst + i)), _mm_loadu_si128((const __m128i *)(src + i)));
+    _mm_storeu_si128((__m128i *)(dst + i), sum);
+  }
+#endif
+  for (; i < size; i++)
+  {
+    dst[i] += src[i];
   }
+}
 
-  max_sum = current_sum;
+// Multiplier that scales a fraction of n parsed digits to units of 1e-9 ps
+static const uint32_t fraction_scale[FRACTION_DIGITS + 1] = {1, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1};
 
-  // Slide the window and update the sum
-  for (int i = window_size; i < size; i++)
+// Function to parse one "timestamp,channel" line, returns 1 if the line holds a timestamp
+int parse_time_tag_line(const char *p, const char *end, struct time_tag *tag)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
   {
-    current_sum += histogram[i] - histogram[i - window_size];
-    if (current_sum > max_sum)
+    p++;
+  }
+
+  int negative = 0;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = (*p == '-');
+    p++;
+  }
+  if (p == end || *p < '0' || *p > '9')
+  {
+    return 0;
+  }
+
+  int64_t timestamp = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+  {
+    timestamp = timestamp * 10 + (*p++ - '0');
+  }
+
+  // Fractional picoseconds are kept in fixed point: up to FRACTION_DIGITS digits, the rest is dropped
+  uint32_t fraction = 0;
+  if (p < end && *p == '.')
+  {
+    int digits = 0;
+    p++;
+    while (p < end && *p >= '0' && *p <= '9')
     {
-      max_sum = current_sum;
-      start_index = i - window_size + 1;
+      if (digits < FRACTION_DIGITS)
+      {
+        fraction = fraction * 10 + (*p - '0');
+        digits++;
+      }
+      p++;
     }
+    fraction *= fraction_scale[digits];
   }
 
-  // Divide the window into 3 equal parts (without guard bands)
-  int part_size = window_size / 3;
-  int C1 = 0, D1 = 0, C2 = 0;
+  // The channel column is optional and defaults to 0
+  int32_t channel = 0;
+  while (p < end && (*p == ' ' || *p == '\t'))
+  {
+    p++;
+  }
+  if (p < end && *p == ',')
+  {
+    p++;
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+      channel = channel * 10 + (*p++ - '0');
+    }
+  }
 
-  for (int i = start_index; i < start_index + window_size; i++)
+  // Keep the fraction non-negative: -5.25 ps is -6 ps + 0.75 ps
+  if (negative && fraction > 0)
   {
-    if (i < start_index + part_size)
+    timestamp++;
+    fraction = FRACTION_UNIT - fraction;
+  }
+  tag->timestamp = negative ? -timestamp : timestamp;
+  tag->channel = channel;
+  tag->fraction = fraction;
+  return 1;
+}
+
+// Function to refill the CSV buffer, keeping the unparsed tail of the previous read
+void csv_reader_refill(struct csv_reader *reader)
+{
+  size_t remaining = reader->length - reader->position;
+  memmove(reader->buffer, reader->buffer + reader->position, remaining);
+  reader->buffer_offset += reader->position;
+  reader->length = remaining;
+  reader->position = 0;
+
+  size_t bytes = fread(reader->buffer + remaining, 1, CSV_BUFFER_SIZE - remaining, reader->file);
+  reader->length += bytes;
+  if (bytes == 0)
+  {
+    reader->eof = 1;
+  }
+}
+
+// Function to find the end of the next line, refilling the buffer as needed. Returns NULL at end of file.
+const char *csv_reader_next_line(struct csv_reader *reader)
+{
+  for (;;)
+  {
+    const char *start = reader->buffer + reader->position;
+    const char *newline = memchr(start, '\n', reader->length - reader->position);
+    if (newline)
     {
-      C1 += histogram[i];
+      return newline;
     }
-    else if (i < start_index + 2 * part_size)
+    if (reader->eof)
     {
-      D1 += histogram[i];
+      // Last line without a trailing newline
+      return reader->position < reader->length && !reader->complete_lines_only ? reader->buffer + reader->length : NULL;
     }
-    else
+    if (reader->position == 0 && reader->length == CSV_BUFFER_SIZE)
     {
-      C2 += histogram[i];
+      printf("Error: CSV line longer than %d bytes\n", CSV_BUFFER_SIZE);
+      exit(1);
     }
+    csv_reader_refill(reader);
   }
+}
 
-  // Calculate BER and visibility
-  *BER1 = (double)D1 / (C1 + D1 + C2);
-  *V1 = (double)(C1 + C2) / D1;
+// Function to open a CSV file for time-tag reading at a byte offset; at offset 0 the header row is skipped
+void csv_reader_open_at(struct csv_reader *reader, const char *filename, int64_t offset, int complete_lines_only)
+{
+  reader->file = fopen(filename, "r");
+  if (!reader->file)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+  reader->buffer = malloc(CSV_BUFFER_SIZE);
+  if (!reader->buffer)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  reader->length = 0;
+  reader->position = 0;
+  reader->buffer_offset = offset;
+  reader->end_offset = INT64_MAX;
+  reader->eof = 0;
+  reader->complete_lines_only = complete_lines_only;
+  if (offset > 0)
+  {
+    fseeko(reader->file, offset, SEEK_SET);
+    return;
+  }
 
-  return start_index;
+  // Skip the first row (header)
+  const char *line_end = csv_reader_next_line(reader);
+  if (line_end)
+  {
+    reader->position = line_end - reader->buffer + (line_end < reader->buffer + reader->length);
+  }
 }
 
-// Function to apply guard bands and calculate BER2 and Visibility2
-void apply_guard_bands_and_calculate(int histogram[], int start_index, int window_size, double *BER2, double *V2, int guard_band)
+// Function to open a CSV file for time-tag reading and skip its header row
+void csv_reader_open(struct csv_reader *reader, const char *filename)
 {
-  int part_size = window_size / 3;
-  int C1 = 0, D1 = 0, C2 = 0;
-  int last_bin_index = start_index + window_size - 1;
+  csv_reader_open_at(reader, filename, 0, 0);
+}
 
-  // Apply guard bands (ignore the first and last 100ps of each 1ns bin)
-  for (int i = start_index; i <= last_bin_index; i++)
+// Function to open the byte range [start, end) of a CSV file: it covers exactly the lines that start
+// inside the range, so adjacent ranges split a file without losing or duplicating a line
+void csv_reader_open_range(struct csv_reader *reader, const char *filename, int64_t start, int64_t end)
+{
+  if (start == 0)
   {
-    // If within the guard band, skip the timestamp
-    int half_guard_band = (int)guard_band / 2;
+    csv_reader_open_at(reader, filename, 0, 0);
+  }
+  else
+  {
+    // Start one byte early so a line beginning exactly at start is kept, and skip the partial line
+    csv_reader_open_at(reader, filename, start - 1, 0);
+    const char *line_end = csv_reader_next_line(reader);
+    if (line_end)
+    {
+      reader->position = line_end - reader->buffer + (line_end < reader->buffer + reader->length);
+    }
+  }
+  reader->end_offset = end;
+}
+
+// Function to return the file offset of the first byte not consumed yet
+int64_t csv_reader_offset(const struct csv_reader *reader)
+{
+  return reader->buffer_offset + reader->position;
+}
+
+void csv_reader_close(struct csv_reader *reader)
+{
+  fclose(reader->file);
+  free(reader->buffer);
+}
+
+// Function to read up to max_tags time tags from the CSV, skipping lines without a timestamp
+size_t csv_reader_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct csv_reader *reader = context;
+  size_t count = 0;
 
-    // First bin: only remove timestamps from the last half_guard_band ps
-    if (i == 0 && (i % 1000) > (1000 - half_guard_band))
+  while (count < max_tags && reader->buffer_offset + (int64_t)reader->position < reader->end_offset)
+  {
+    const char *line_end = csv_reader_next_line(reader);
+    if (!line_end)
     {
-      continue; // Skip last half_guard_band ps of the first bin
+      break;
     }
+    const char *line = reader->buffer + reader->position;
+    count += parse_time_tag_line(line, line_end, &tags[count]);
+    reader->position = line_end - reader->buffer + (line_end < reader->buffer + reader->length);
+  }
+  return count;
+}
+
+/*
+  Privatized histogram fill
+
+  Detector data piles up in a few hundred bins, so consecutive increments often hit the same counter and
+  each one has to wait for the previous store to be forwarded. The fill kernel deals consecutive events
+  round-robin over HISTOGRAM_COPIES separate sub-histograms, which turns one serial dependency chain
+  into independent ones; the copies are summed with SIMD adds when the histogram is needed. More copies
+  cost cache space, which is why wide fills lose on uniform data; --benchmark-fill compares the variants
+  with the naive loop on clustered and uniform data so the default can be checked on the target machine.
+*/
+
+#ifndef HISTOGRAM_COPIES
+#define HISTOGRAM_COPIES 4                // Sub-histograms of the privatized fill (-DHISTOGRAM_COPIES=1 for the naive loop)
+#endif
+#define FILL_BENCHMARK_EVENTS (8 << 20)   // Events per benchmark distribution
+#define FILL_BENCHMARK_POOL (16 * TAG_BLOCK_SIZE) // Distinct tags, cycled so that parsing-sized blocks stay in cache
+#define FILL_BENCHMARK_REPEATS 5          // Best of this many runs is reported
 
-    // Last bin: only remove timestamps from the first half_guard_band ps
-    if (i == last_bin_index && (i % 1000) < half_guard_band)
+// Function to bin a block of time tags into `copies` sub-histograms of WINDOW_SIZE bins each
+void fill_histogram_copies(const struct time_tag *tags, size_t count, int *copies, int copy_count)
+{
+  size_t i = 0;
+  if (copy_count == 4)
+  {
+    // Fixed-width path the compiler keeps fully unrolled
+    for (; i + 4 <= count; i += 4)
+    {
+      copies[window_bin(tags[i].timestamp)]++;
+      copies[WINDOW_SIZE + window_bin(tags[i + 1].timestamp)]++;
+      copies[2 * WINDOW_SIZE + window_bin(tags[i + 2].timestamp)]++;
+      copies[3 * WINDOW_SIZE + window_bin(tags[i + 3].timestamp)]++;
+    }
+  }
+  for (; i + copy_count <= count; i += copy_count)
+  {
+    for (int c = 0; c < copy_count; c++)
     {
-      continue; // Skip first half_guard_band ps of the last bin
+      copies[c * WINDOW_SIZE + window_bin(tags[i + c].timestamp)]++;
     }
+  }
+  for (; i < count; i++)
+  {
+    copies[window_bin(tags[i].timestamp)]++;
+  }
+}
+
+// Function to sum the sub-histograms into the first one
+void merge_histogram_copies(int *copies, int copy_count)
+{
+  for (int c = 1; c < copy_count; c++)
+  {
+    add_histograms(copies, copies + (size_t)c * WINDOW_SIZE, WINDOW_SIZE);
+  }
+}
+
+// Function to populate the histogram from any time-tag source (same binning as the CSV path), returns the event count
+uint64_t fill_histogram_from_source(struct tag_source *source, int *histogram)
+{
+  struct time_tag tags[TAG_BLOCK_SIZE];
+  uint64_t events = 0;
+  size_t count;
+  int *copies = calloc((size_t)HISTOGRAM_COPIES * WINDOW_SIZE, sizeof(int));
+  if (!copies)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
 
-    if ((i % 1000) < half_guard_band || (i % 1000) > (1000 - half_guard_band))
+  while ((count = source->read(source->context, tags, TAG_BLOCK_SIZE)) > 0)
+  {
+    fill_histogram_copies(tags, count, copies, HISTOGRAM_COPIES);
+    events += count;
+  }
+  merge_histogram_copies(copies, HISTOGRAM_COPIES);
+  memcpy(histogram, copies, WINDOW_SIZE * sizeof(int));
+  free(copies);
+  return events;
+}
+
+// Function to populate a histogram of WINDOW_SIZE * subdivisions sub-ps bins from any time-tag source, returns the
+// event count. The sub-bin comes from the fixed-point fraction with integer arithmetic only.
+uint64_t fill_subps_histogram_from_source(struct tag_source *source, int *histogram, int subdivisions)
+{
+  struct time_tag tags[TAG_BLOCK_SIZE];
+  uint64_t events = 0;
+  size_t count;
+
+  memset(histogram, 0, (size_t)WINDOW_SIZE * subdivisions * sizeof(int));
+  while ((count = source->read(source->context, tags, TAG_BLOCK_SIZE)) > 0)
+  {
+    for (size_t i = 0; i < count; i++)
     {
-      continue; // Skip timestamps in the guard band
+      histogram[window_bin(tags[i].timestamp) * subdivisions + (int)((uint64_t)tags[i].fraction * subdivisions / FRACTION_UNIT)]++;
     }
+    events += count;
+  }
+  return events;
+}
 
-    // Otherwise, accumulate counts
-    if (i < start_index + part_size)
+// Function to time one fill variant (copy_count 0 = naive loop), returns the best ns per event
+double time_histogram_fill(const struct time_tag *tags, size_t count, int copy_count, int *copies)
+{
+  double best = 0;
+  for (int repeat = 0; repeat < FILL_BENCHMARK_REPEATS; repeat++)
+  {
+    struct timespec begin, end;
+    memset(copies, 0, (size_t)(copy_count > 0 ? copy_count : 1) * WINDOW_SIZE * sizeof(int));
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (size_t done = 0; done < FILL_BENCHMARK_EVENTS; done += TAG_BLOCK_SIZE)
     {
-      C1 += histogram[i];
+      const struct time_tag *block = tags + done % count;
+      if (copy_count == 0)
+      {
+        for (size_t i = 0; i < TAG_BLOCK_SIZE; i++)
+        {
+          copies[window_bin(block[i].timestamp)]++;
+        }
+      }
+      else
+      {
+        fill_histogram_copies(block, TAG_BLOCK_SIZE, copies, copy_count);
+      }
     }
-    else if (i < start_index + 2 * part_size)
+    if (copy_count > 1)
     {
-      D1 += histogram[i];
+      merge_histogram_copies(copies, copy_count);
     }
-    else
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = ((end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec)) / FILL_BENCHMARK_EVENTS;
+    best = repeat == 0 || ns < best ? ns : best;
+  }
+  return best;
+}
+
+// Function to compare the naive fill with the privatized fill on clustered and uniform timestamps
+void run_fill_benchmark(void)
+{
+  struct time_tag *tags = malloc(FILL_BENCHMARK_POOL * sizeof(struct time_tag));
+  int *copies = malloc(8 * WINDOW_SIZE * sizeof(int));
+  int *reference = malloc(WINDOW_SIZE * sizeof(int));
+  const char *names[2] = {"clustered", "uniform"};
+  const int variants[4] = {0, 2, 4, 8};
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+  if (!tags || !copies || !reference)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  printf("distribution,copies,ns_per_event,speedup\n");
+  for (int distribution = 0; distribution < 2; distribution++)
+  {
+    // Clustered: three 1ns slots as in a time-bin qubit, each event within +-40ps of a slot centre
+    int64_t time = 0;
+    for (size_t i = 0; i < FILL_BENCHMARK_POOL; i++)
     {
-      C2 += histogram[i];
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      time += WINDOW_SIZE * (int64_t)(1 + state % 16);
+      if (distribution == 0)
+      {
+        tags[i].timestamp = time + 10000 + 1000 * (int64_t)(state >> 60 & 1 ? 2 * (state >> 61 & 1) : 1) +
+                            (int64_t)((state >> 20) % 81) - 40;
+      }
+      else
+      {
+        tags[i].timestamp = time + (int64_t)((state >> 20) % WINDOW_SIZE);
+      }
+      tags[i].channel = 0;
+      tags[i].fraction = 0;
+    }
+
+    double naive = time_histogram_fill(tags, FILL_BENCHMARK_POOL, 0, copies);
+    memcpy(reference, copies, WINDOW_SIZE * sizeof(int));
+    for (int v = 0; v < 4; v++)
+    {
+      double ns = v == 0 ? naive : time_histogram_fill(tags, FILL_BENCHMARK_POOL, variants[v], copies);
+      if (memcmp(reference, copies, WINDOW_SIZE * sizeof(int)) != 0)
+      {
+        printf("Error: Fill with %d copies disagrees with the naive fill\n", variants[v]);
+        exit(1);
+      }
+      printf("%s,%d,%.3f,%.2f\n", names[distribution], variants[v] ? variants[v] : 1, ns, naive / ns);
     }
   }
+  free(tags);
+  free(copies);
+  free(reference);
+}
 
-  // Calculate BER and visibility after applying guard bands
-  *BER2 = (double)D1 / (C1 + D1 + C2);
-  *V2 = (C1 + C2) / D1 ;
+// Pass-through stage that copies every block it forwards into a binary time-tag file
+struct tag_tee
+{
+  struct tag_source *upstream;
+  int fd;
+};
+
+size_t tag_tee_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct tag_tee *tee = context;
+  size_t count = tee->upstream->read(tee->upstream->context, tags, max_tags);
+  write_all(tee->fd, tags, count * sizeof(struct time_tag));
+  return count;
 }
 
-// Function to loop through different guard bands and find optimal values
-void find_optimal_guard_bands(int histogram[], int start_index, int window_size)
+/*
+  Tiered histogram
+
+  An int histogram is WINDOW_SIZE * 4 = 128 KB, which does not fit in L1 and competes for L2 with the
+  parse buffers; stages that keep many histograms live (time slices, sliding-window deltas) multiply
+  that. The tiered layout keeps 16-bit hot counters (64 KB) and carries every wrap of a counter into a
+  64-bit master table, so counts stay exact however long the capture. The master table is allocated on
+  the first wrap only; a bin has to collect 65536 events before it is touched at all.
+*/
+
+struct tiered_histogram
 {
-  double min_BER = 1.0;        // Initialize with max possible BER (1)
-  double max_visibility = 0.0; // Initialize with min possible Visibility (0)
-  int optimal_BER_guard_band = 0;
-  int optimal_visibility_guard_band = 0;
+  uint16_t *bins;    // Hot counters, count modulo 65536
+  uint64_t *master;  // Carried multiples of 65536 (NULL until the first wrap)
+};
 
-  // Loop through guard band widths
-  for (int guard_band = MIN_GUARD_BAND; guard_band <= MAX_GUARD_BAND; guard_band += GUARD_BAND_STEP)
+void tiered_histogram_init(struct tiered_histogram *tiered)
+{
+  tiered->bins = calloc(WINDOW_SIZE, sizeof(uint16_t));
+  tiered->master = NULL;
+  if (!tiered->bins)
   {
-    double BER, visibility;
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+}
 
-    // Calculate BER and visibility for the current guard band
-    apply_guard_bands_and_calculate(histogram, start_index, window_size, &BER, &visibility, guard_band);
+void tiered_histogram_free(struct tiered_histogram *tiered)
+{
+  free(tiered->bins);
+  free(tiered->master);
+}
 
-    // Update minimum BER and corresponding guard band
-    if (BER < min_BER)
+// Function to carry a wrapped 16-bit counter into the master table
+void tiered_histogram_carry(struct tiered_histogram *tiered, int bin)
+{
+  if (!tiered->master)
+  {
+    tiered->master = calloc(WINDOW_SIZE, sizeof(uint64_t));
+    if (!tiered->master)
     {
-      min_BER = BER;
-      optimal_BER_guard_band = guard_band;
+      printf("Error: Out of memory\n");
+      exit(1);
     }
+  }
+  tiered->master[bin] += 65536;
+}
 
-    // Update maximum Visibility and corresponding guard band
-    if (visibility > max_visibility)
+void tiered_histogram_add(struct tiered_histogram *tiered, int bin)
+{
+  if (++tiered->bins[bin] == 0)
+  {
+    tiered_histogram_carry(tiered, bin);
+  }
+}
+
+// Function to write the counts into an int histogram for the analysis functions
+void tiered_histogram_expand(const struct tiered_histogram *tiered, int *histogram)
+{
+  if (tiered->master)
+  {
+    for (int i = 0; i < WINDOW_SIZE; i++)
     {
-      max_visibility = visibility;
-      optimal_visibility_guard_band = guard_band;
+      histogram[i] = (int)(tiered->bins[i] + tiered->master[i]);
+    }
+  }
+  else
+  {
+    for (int i = 0; i < WINDOW_SIZE; i++)
+    {
+      histogram[i] = tiered->bins[i];
     }
   }
-
-  // Print results
-  printf("Optimal Guard Band for Minimum BER: %d ps with BER = %.5f\n", optimal_BER_guard_band, min_BER);
-  printf("Optimal Guard Band for Maximum Visibility: %d ps with Visibility = %.5f\n", optimal_visibility_guard_band, max_visibility);
 }
 
-int main(int argc, char *argv[])
+void tiered_histogram_clear(struct tiered_histogram *tiered)
 {
-  if (argc != 2)
+  memset(tiered->bins, 0, WINDOW_SIZE * sizeof(uint16_t));
+  if (tiered->master)
   {
-    printf("Usage: %s <filename>\n", argv[0]);
-    return 1;
+    memset(tiered->master, 0, WINDOW_SIZE * sizeof(uint64_t));
   }
+}
 
-  const char *filename = argv[1]; // Input CSV file name (timestamps in picoseconds)
-  int histogram[WINDOW_SIZE];
+/*
+  External-memory merge sort
 
-  // Process the CSV file and populate the histogram
-  process_csv_and_create_histogram(filename, histogram);
+  Captures larger than RAM are sorted in two phases:
+    1. Run generation: the CSV is read in chunks that fill the memory budget. Each chunk is split
+       into one slice per thread, the slices are sorted in parallel and spilled to unlinked
+       temporary files in the binary time-tag format (one sequential write per run).
+    2. Merge: all runs are k-way merged with a loser tree. Every run gets an equal share of the
+       memory budget as its read buffer, so reads stay large and sequential. If the share would
+       drop below MIN_MERGE_BUFFER, runs are first merged in groups into longer runs.
+  The merged output is exposed as a tag_source, so the histogram stage consumes it directly.
+*/
 
-  double BER1, V1, BER2, V2;
+struct external_sort_config
+{
+  size_t memory_budget; // Bytes for run buffers during both phases
+  int threads;          // Threads sorting runs in parallel
+  const char *temp_dir; // Directory for spilled runs
+};
 
-  // Find the 3ns window with the maximum sum and calculate BER1 and Visibility1
-  int start_index = find_max_sum_window(histogram, WINDOW_SIZE, 3000, &BER1, &V1);
+// One spilled, sorted run
+struct sort_run
+{
+  int fd;
+};
 
-  // Apply guard bands and calculate BER2 and Visibility2
-  apply_guard_bands_and_calculate(histogram, start_index, 3000, &BER2, &V2, GUARD_BAND);
+// Read side of one run during the merge
+struct merge_input
+{
+  int fd;
+  struct time_tag *buffer;
+  size_t capacity; // Buffer size in tags
+  size_t count;    // Tags currently in buffer
+  size_t position; // Next tag to emit
+  off_t offset;    // Next file offset to read
+  int exhausted;
+};
 
-  // Output the results
-  printf("%s,%lf,%lf,%lf,%lf\n", GROUP, BER1, V1, BER2, V2);
+// k-way merge of sorted runs with a loser tree:
+// tree[0] holds the index of the current winner, tree[1..k-1] the losers of each match.
+struct merge_stream
+{
+  int k;
+  struct merge_input *inputs;
+  int *tree;
+};
+
+int compare_time_tags(const void *a, const void *b)
+{
+  const struct time_tag *x = a, *y = b;
+  if (x->timestamp != y->timestamp)
+  {
+    return x->timestamp < y->timestamp ? -1 : 1;
+  }
+  return (x->channel > y->channel) - (x->channel < y->channel);
+}
+
+// Function to create an anonymous spill file (unlinked right away so it vanishes with the process)
+int create_spill_file(const char *temp_dir)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/qber_run_XXXXXX", temp_dir);
+  int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    printf("Error: Could not create temporary file in %s\n", temp_dir);
+    exit(1);
+  }
+  unlink(path);
+  return fd;
+}
 
-  // Uncomment the below code to find optimal guard band.
-  // find_optimal_guard_bands(histogram, start_index, 3000);
+struct sort_slice
+{
+  struct time_tag *tags;
+  size_t count;
+};
+
+void *sort_slice_thread(void *argument)
+{
+  struct sort_slice *slice = argument;
+  qsort(slice->tags, slice->count, sizeof(struct time_tag), compare_time_tags);
+  return NULL;
+}
+
+// Function to append a run to the run list, growing it as needed
+void add_sort_run(struct sort_run **runs, int *run_count, int *run_capacity, int fd)
+{
+  if (*run_count == *run_capacity)
+  {
+    *run_capacity = *run_capacity ? 2 * *run_capacity : 16;
+    *runs = realloc(*runs, *run_capacity * sizeof(struct sort_run));
+    if (!*runs)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+  (*runs)[(*run_count)++].fd = fd;
+}
+
+// Function to split the input into sorted runs on disk (phase 1)
+int generate_sorted_runs(struct tag_source *source, const struct external_sort_config *config, struct sort_run **runs)
+{
+  size_t chunk_capacity = config->memory_budget / sizeof(struct time_tag);
+  struct time_tag *chunk = malloc(chunk_capacity * sizeof(struct time_tag));
+  pthread_t *threads = malloc(config->threads * sizeof(pthread_t));
+  struct sort_slice *slices = malloc(config->threads * sizeof(struct sort_slice));
+  if (!chunk || !threads || !slices)
+  {
+    printf("Error: Could not allocate %zu bytes for the sort buffer\n", config->memory_budget);
+    exit(1);
+  }
+
+  int run_count = 0, run_capacity = 0;
+  *runs = NULL;
+
+  for (;;)
+  {
+    // Fill the chunk up to the memory budget
+    size_t count = 0, got;
+    while (count < chunk_capacity &&
+           (got = source->read(source->context, chunk + count, chunk_capacity - count)) > 0)
+    {
+      count += got;
+    }
+    if (count == 0)
+    {
+      break;
+    }
+
+    // Sort one slice per thread, then spill every slice as its own run
+    size_t slice_size = (count + config->threads - 1) / config->threads;
+    int slice_count = 0;
+    for (size_t first = 0; first < count; first += slice_size)
+    {
+      slices[slice_count].tags = chunk + first;
+      slices[slice_count].count = first + slice_size <= count ? slice_size : count - first;
+      if (pthread_create(&threads[slice_count], NULL, sort_slice_thread, &slices[slice_count]) != 0)
+      {
+        printf("Error: Could not start sort thread\n");
+        exit(1);
+      }
+      slice_count++;
+    }
+    for (int i = 0; i < slice_count; i++)
+    {
+      pthread_join(threads[i], NULL);
+      int fd = create_spill_file(config->temp_dir);
+      write_all(fd, slices[i].tags, slices[i].count * sizeof(struct time_tag));
+      add_sort_run(runs, &run_count, &run_capacity, fd);
+    }
+
+    if (count < chunk_capacity)
+    {
+      break;
+    }
+  }
+
+  free(chunk);
+  free(threads);
+  free(slices);
+  return run_count;
+}
+
+// Function to load the next block of a run into its buffer
+void merge_input_refill(struct merge_input *input)
+{
+  ssize_t bytes = pread(input->fd, input->buffer, input->capacity * sizeof(struct time_tag), input->offset);
+  if (bytes < 0)
+  {
+    printf("Error: Could not read sorted run\n");
+    exit(1);
+  }
+  input->offset += bytes;
+  input->count = bytes / sizeof(struct time_tag);
+  input->position = 0;
+  input->exhausted = (input->count == 0);
+}
+
+// Returns nonzero if input a must be emitted before input b. Index k is the "minus infinity"
+// sentinel used while building the tree; exhausted inputs compare as "plus infinity".
+int merge_input_before(const struct merge_stream *stream, int a, int b)
+{
+  if (a == stream->k)
+  {
+    return 1;
+  }
+  if (b == stream->k)
+  {
+    return 0;
+  }
+
+  const struct merge_input *x = &stream->inputs[a], *y = &stream->inputs[b];
+  if (x->exhausted || y->exhausted)
+  {
+    return !x->exhausted;
+  }
+
+  int order = compare_time_tags(&x->buffer[x->position], &y->buffer[y->position]);
+  return order != 0 ? order < 0 : a < b;
+}
+
+// Function to replay the matches from leaf to root after the leaf's head changed
+void loser_tree_adjust(struct merge_stream *stream, int leaf)
+{
+  int winner = leaf;
+  for (int node = (leaf + stream->k) / 2; node > 0; node /= 2)
+  {
+    if (merge_input_before(stream, stream->tree[node], winner))
+    {
+      int loser = winner;
+      winner = stream->tree[node];
+      stream->tree[node] = loser;
+    }
+  }
+  stream->tree[0] = winner;
+}
+
+// Function to start a k-way merge over the runs, giving each run buffer_bytes of read buffer
+void merge_stream_open(struct merge_stream *stream, struct sort_run *runs, int k, size_t buffer_bytes)
+{
+  stream->k = k;
+  stream->inputs = calloc(k > 0 ? k : 1, sizeof(struct merge_input));
+  stream->tree = malloc((k > 0 ? k : 1) * sizeof(int));
+  if (!stream->inputs || !stream->tree)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < k; i++)
+  {
+    struct merge_input *input = &stream->inputs[i];
+    input->fd = runs[i].fd;
+    input->capacity = buffer_bytes / sizeof(struct time_tag);
+    input->buffer = malloc(input->capacity * sizeof(struct time_tag));
+    if (!input->buffer)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+    input->offset = 0;
+    merge_input_refill(input);
+  }
+
+  // Build the tree: start from all-sentinel nodes and insert every leaf
+  for (int i = 0; i < k; i++)
+  {
+    stream->tree[i] = k;
+  }
+  for (int i = k - 1; i >= 0; i--)
+  {
+    loser_tree_adjust(stream, i);
+  }
+}
+
+// tag_source read function: emits the merged, time-ordered stream
+size_t merge_stream_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct merge_stream *stream = context;
+  size_t count = 0;
+
+  if (stream->k == 0)
+  {
+    return 0;
+  }
+
+  while (count < max_tags)
+  {
+    int winner = stream->tree[0];
+    struct merge_input *input = &stream->inputs[winner];
+    if (input->exhausted)
+    {
+      break; // The winner is only exhausted once every run is
+    }
+
+    tags[count++] = input->buffer[input->position++];
+    if (input->position == input->count)
+    {
+      merge_input_refill(input);
+    }
+    loser_tree_adjust(stream, winner);
+  }
+  return count;
+}
+
+// Function to release the merge buffers and close the underlying runs
+void merge_stream_close(struct merge_stream *stream)
+{
+  for (int i = 0; i < stream->k; i++)
+  {
+    free(stream->inputs[i].buffer);
+    close(stream->inputs[i].fd);
+  }
+  free(stream->inputs);
+  free(stream->tree);
+}
+
+// Function to sort a stream of any size and open the merged result as a time-ordered stream
+void external_sort_open(struct tag_source *source, const struct external_sort_config *config, struct merge_stream *stream)
+{
+  struct sort_run *runs;
+  int run_count = generate_sorted_runs(source, config, &runs);
+
+  // Merge groups of runs until every remaining run gets at least MIN_MERGE_BUFFER of read buffer
+  int fan_in = (int)(config->memory_budget / MIN_MERGE_BUFFER) - 1;
+  if (fan_in < 2)
+  {
+    fan_in = 2;
+  }
+  while (run_count > fan_in + 1)
+  {
+    size_t buffer_bytes = config->memory_budget / (fan_in + 1);
+    struct time_tag *output = malloc(buffer_bytes);
+    if (!output)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+
+    int merged_count = 0;
+    for (int first = 0; first < run_count; first += fan_in)
+    {
+      int group = run_count - first < fan_in ? run_count - first : fan_in;
+      if (group == 1)
+      {
+        runs[merged_count++] = runs[first];
+        continue;
+      }
+
+      struct merge_stream pass;
+      merge_stream_open(&pass, runs + first, group, buffer_bytes);
+      int fd = create_spill_file(config->temp_dir);
+      size_t count;
+      while ((count = merge_stream_read(&pass, output, buffer_bytes / sizeof(struct time_tag))) > 0)
+      {
+        write_all(fd, output, count * sizeof(struct time_tag));
+      }
+      merge_stream_close(&pass);
+      runs[merged_count++].fd = fd;
+    }
+    run_count = merged_count;
+    free(output);
+  }
+
+  merge_stream_open(stream, runs, run_count, config->memory_budget / (run_count > 0 ? run_count : 1));
+  free(runs);
+}
+
+/*
+  Reorder buffer
+
+  Multi-channel taggers emit events that are only locally out of order. Instead of a full sort,
+  events are dropped into a ring of time buckets (bucket_width ps each) covering the disorder
+  horizon. Once the newest timestamp seen is more than horizon ps past the end of the oldest
+  bucket, no in-tolerance event can still land there, so that bucket is sorted (it is small) and
+  emitted. Every event is inserted and emitted once and every bucket is flushed once, so the cost is
+  O(1) amortized per event. Events later than the horizon are passed through immediately and
+  counted as late.
+*/
+
+#define DEFAULT_REORDER_BUCKETS 64 // Buckets per disorder horizon
+
+struct reorder_bucket
+{
+  struct time_tag *tags;
+  size_t count;
+  size_t capacity;
+};
+
+struct reorder_buffer
+{
+  struct tag_source *upstream;
+  int64_t horizon;      // Largest tolerated disorder in ps
+  int64_t bucket_width; // ps covered by one bucket
+  int bucket_count;     // Power of two, > horizon / bucket_width + 1
+  struct reorder_bucket *buckets;
+  int64_t cursor;       // Start time of the oldest bucket that has not been emitted
+  int64_t newest;       // Largest timestamp seen so far
+  size_t buffered;      // Tags held in buckets
+  int started;
+  int upstream_done;
+
+  // Tags ready to be handed downstream
+  struct time_tag *ready;
+  size_t ready_count, ready_position, ready_capacity;
+
+  // Statistics
+  int64_t max_disorder;  // Largest newest - timestamp observed, in ps
+  uint64_t late_events;  // Events that arrived more than horizon ps late
+  uint64_t events;
+};
+
+// Function to divide rounding towards minus infinity (timestamps may be negative)
+int64_t floor_div(int64_t value, int64_t divisor)
+{
+  int64_t quotient = value / divisor;
+  return (value % divisor != 0 && (value < 0) != (divisor < 0)) ? quotient - 1 : quotient;
+}
+
+void reorder_buffer_init(struct reorder_buffer *buffer, struct tag_source *upstream, int64_t horizon)
+{
+  memset(buffer, 0, sizeof(*buffer));
+  buffer->upstream = upstream;
+  buffer->horizon = horizon > 0 ? horizon : 1;
+  buffer->bucket_width = (buffer->horizon + DEFAULT_REORDER_BUCKETS - 1) / DEFAULT_REORDER_BUCKETS;
+
+  int64_t needed = buffer->horizon / buffer->bucket_width + 2;
+  buffer->bucket_count = 1;
+  while (buffer->bucket_count < needed)
+  {
+    buffer->bucket_count *= 2;
+  }
+  buffer->buckets = calloc(buffer->bucket_count, sizeof(struct reorder_bucket));
+  if (!buffer->buckets)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+}
+
+void reorder_buffer_free(struct reorder_buffer *buffer)
+{
+  for (int i = 0; i < buffer->bucket_count; i++)
+  {
+    free(buffer->buckets[i].tags);
+  }
+  free(buffer->buckets);
+  free(buffer->ready);
+}
+
+// Function to append tags to the ready queue
+void reorder_emit(struct reorder_buffer *buffer, const struct time_tag *tags, size_t count)
+{
+  if (buffer->ready_count + count > buffer->ready_capacity)
+  {
+    buffer->ready_capacity = 2 * (buffer->ready_count + count);
+    buffer->ready = realloc(buffer->ready, buffer->ready_capacity * sizeof(struct time_tag));
+    if (!buffer->ready)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+  memcpy(buffer->ready + buffer->ready_count, tags, count * sizeof(struct time_tag));
+  buffer->ready_count += count;
+}
+
+// Function to sort the oldest bucket, move it to the ready queue and advance the cursor
+void reorder_flush_oldest(struct reorder_buffer *buffer)
+{
+  int index = (int)(floor_div(buffer->cursor, buffer->bucket_width) & (buffer->bucket_count - 1));
+  struct reorder_bucket *bucket = &buffer->buckets[index];
+
+  // Insertion sort: buckets are small and usually almost sorted already
+  for (size_t i = 1; i < bucket->count; i++)
+  {
+    struct time_tag tag = bucket->tags[i];
+    size_t j = i;
+    while (j > 0 && compare_time_tags(&bucket->tags[j - 1], &tag) > 0)
+    {
+      bucket->tags[j] = bucket->tags[j - 1];
+      j--;
+    }
+    bucket->tags[j] = tag;
+  }
+
+  reorder_emit(buffer, bucket->tags, bucket->count);
+  buffer->buffered -= bucket->count;
+  bucket->count = 0;
+  buffer->cursor += buffer->bucket_width;
+}
+
+// Function to emit every bucket that can no longer receive in-tolerance events
+void reorder_advance(struct reorder_buffer *buffer, int64_t limit)
+{
+  while (buffer->cursor + buffer->bucket_width <= limit)
+  {
+    if (buffer->buffered == 0)
+    {
+      // Nothing pending: jump over the empty stretch instead of visiting every bucket
+      buffer->cursor = floor_div(limit, buffer->bucket_width) * buffer->bucket_width;
+      break;
+    }
+    reorder_flush_oldest(buffer);
+  }
+}
+
+// Function to insert one tag into the ring
+void reorder_insert(struct reorder_buffer *buffer, const struct time_tag *tag)
+{
+  int64_t timestamp = tag->timestamp;
+  buffer->events++;
+
+  if (!buffer->started)
+  {
+    buffer->started = 1;
+    buffer->newest = timestamp;
+    buffer->cursor = floor_div(timestamp - buffer->horizon, buffer->bucket_width) * buffer->bucket_width;
+  }
+
+  if (timestamp > buffer->newest)
+  {
+    buffer->newest = timestamp;
+    reorder_advance(buffer, timestamp - buffer->horizon);
+  }
+  else if (buffer->newest - timestamp > buffer->max_disorder)
+  {
+    buffer->max_disorder = buffer->newest - timestamp;
+  }
+
+  if (timestamp < buffer->cursor)
+  {
+    // Later than the horizon allows: its slot was already emitted
+    buffer->late_events++;
+    reorder_emit(buffer, tag, 1);
+    return;
+  }
+
+  int index = (int)(floor_div(timestamp, buffer->bucket_width) & (buffer->bucket_count - 1));
+  struct reorder_bucket *bucket = &buffer->buckets[index];
+  if (bucket->count == bucket->capacity)
+  {
+    bucket->capacity = bucket->capacity ? 2 * bucket->capacity : 64;
+    bucket->tags = realloc(bucket->tags, bucket->capacity * sizeof(struct time_tag));
+    if (!bucket->tags)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+  bucket->tags[bucket->count++] = *tag;
+  buffer->buffered++;
+}
+
+// tag_source read function: emits the upstream tags in time order
+size_t reorder_buffer_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct reorder_buffer *buffer = context;
+  struct time_tag block[TAG_BLOCK_SIZE];
+
+  while (buffer->ready_position == buffer->ready_count)
+  {
+    buffer->ready_count = 0;
+    buffer->ready_position = 0;
+    if (buffer->upstream_done)
+    {
+      return 0;
+    }
+
+    size_t count = buffer->upstream->read(buffer->upstream->context, block, TAG_BLOCK_SIZE);
+    if (count == 0)
+    {
+      // End of input: drain the remaining buckets in order
+      buffer->upstream_done = 1;
+      while (buffer->buffered > 0)
+      {
+        reorder_flush_oldest(buffer);
+      }
+      continue;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+      reorder_insert(buffer, &block[i]);
+    }
+  }
+
+  size_t available = buffer->ready_count - buffer->ready_position;
+  size_t count = available < max_tags ? available : max_tags;
+  memcpy(tags, buffer->ready + buffer->ready_position, count * sizeof(struct time_tag));
+  buffer->ready_position += count;
+  return count;
+}
+
+/*
+  Timestamp rollover unwrapping
+
+  Narrow hardware counters (32 or 48 bits) wrap around, and (int)(timestamp) % WINDOW_SIZE then bins
+  every event after a wrap wrongly, because 2^bits is not a multiple of WINDOW_SIZE. This stage
+  rebuilds monotonic 64-bit timestamps: timestamp = raw + wraps * 2^bits.
+  Wraps are counted either from overflow records (events on a dedicated channel whose timestamp
+  column holds the number of wraps, 0 meaning 1) or, without markers, from backward jumps of more
+  than half the counter range. Blocks are processed in two passes: a branch-free scan that detects
+  whether the block contains any wrap or marker, and, in the common case that it does not, a single
+  vectorizable add of the current offset. Only blocks with a wrap take the scalar path.
+*/
+
+struct rollover_unwrapper
+{
+  struct tag_source *upstream;
+  int counter_bits;
+  int overflow_channel; // Channel carrying overflow records, -1 to infer wraps from the counter
+  int64_t period;       // 2^counter_bits
+  int64_t offset;       // wraps * period
+  int64_t previous;     // Latest raw counter value
+  int started;
+  uint64_t wraps;
+  uint64_t overflow_records;
+};
+
+void rollover_unwrapper_init(struct rollover_unwrapper *unwrapper, struct tag_source *upstream, int counter_bits, int overflow_channel)
+{
+  memset(unwrapper, 0, sizeof(*unwrapper));
+  unwrapper->upstream = upstream;
+  unwrapper->counter_bits = counter_bits;
+  unwrapper->overflow_channel = overflow_channel;
+  unwrapper->period = (int64_t)1 << counter_bits;
+}
+
+// Function to report whether a block needs the scalar path (contains a wrap or an overflow record)
+int rollover_block_has_event(const struct rollover_unwrapper *unwrapper, const struct time_tag *tags, size_t count)
+{
+  int64_t mask = unwrapper->period - 1;
+  int64_t half = unwrapper->period / 2;
+  int found = 0;
+
+  if (unwrapper->overflow_channel >= 0)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      found |= (tags[i].channel == unwrapper->overflow_channel);
+    }
+    return found;
+  }
+
+  int64_t previous = unwrapper->started ? unwrapper->previous : (tags[0].timestamp & mask);
+  found |= llabs((tags[0].timestamp & mask) - previous) > half;
+  for (size_t i = 1; i < count; i++)
+  {
+    found |= llabs((tags[i].timestamp & mask) - (tags[i - 1].timestamp & mask)) > half;
+  }
+  return found;
+}
+
+// Function to unwrap a block in place; overflow records are removed. Returns the new count.
+size_t rollover_unwrap_block(struct rollover_unwrapper *unwrapper, struct time_tag *tags, size_t count)
+{
+  int64_t mask = unwrapper->period - 1;
+  int64_t half = unwrapper->period / 2;
+
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  if (!rollover_block_has_event(unwrapper, tags, count))
+  {
+    // Fast path: one offset for the whole block
+    int64_t offset = unwrapper->offset;
+    for (size_t i = 0; i < count; i++)
+    {
+      tags[i].timestamp = (tags[i].timestamp & mask) + offset;
+    }
+    unwrapper->previous = tags[count - 1].timestamp - offset;
+    unwrapper->started = 1;
+    return count;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    int64_t raw = tags[i].timestamp & mask;
+
+    if (unwrapper->overflow_channel >= 0)
+    {
+      if (tags[i].channel == unwrapper->overflow_channel)
+      {
+        int64_t wraps = tags[i].timestamp > 0 ? tags[i].timestamp : 1;
+        unwrapper->wraps += wraps;
+        unwrapper->overflow_records++;
+        unwrapper->offset += wraps * unwrapper->period;
+        continue;
+      }
+      tags[kept] = tags[i];
+      tags[kept++].timestamp = raw + unwrapper->offset;
+      continue;
+    }
+
+    int64_t timestamp = raw + unwrapper->offset;
+    if (!unwrapper->started)
+    {
+      unwrapper->started = 1;
+      unwrapper->previous = raw;
+    }
+    else if (unwrapper->previous - raw > half)
+    {
+      // Counter went backwards by more than half its range: it wrapped
+      unwrapper->wraps++;
+      unwrapper->offset += unwrapper->period;
+      timestamp += unwrapper->period;
+      unwrapper->previous = raw;
+    }
+    else if (raw - unwrapper->previous > half && unwrapper->offset > 0)
+    {
+      // Slightly late event from before the most recent wrap
+      timestamp -= unwrapper->period;
+    }
+    else if (raw > unwrapper->previous)
+    {
+      unwrapper->previous = raw;
+    }
+
+    tags[kept] = tags[i];
+    tags[kept++].timestamp = timestamp;
+  }
+  return kept;
+}
+
+// tag_source read function: emits tags with monotonic 64-bit timestamps
+size_t rollover_unwrapper_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct rollover_unwrapper *unwrapper = context;
+  size_t count;
+
+  do
+  {
+    count = unwrapper->upstream->read(unwrapper->upstream->context, tags, max_tags);
+    if (count == 0)
+    {
+      return 0;
+    }
+    count = rollover_unwrap_block(unwrapper, tags, count);
+  } while (count == 0); // The block held only overflow records
+
+  return count;
+}
+
+/*
+  Histogram snapshots
+
+  A snapshot stores the per-channel histograms of a capture so the window search and guard-band sweep
+  can be re-run without parsing the CSV again, and so runs from several nights can be summed.
+  File layout (native byte order, little-endian on all supported machines):
+    struct snapshot_header
+    channel_count x struct snapshot_channel
+    channel_count x period x int32 counts (channel-major, same channel order)
+  Snapshots cover the same period; when their resolutions differ the finer one is rebinned exactly to
+  the coarser one before merging.
+*/
+
+#define SNAPSHOT_MAGIC "QBERHIST" // 8 bytes, no terminator stored
+#define SNAPSHOT_VERSION 1
+#define FINGERPRINT_SAMPLE_SIZE (64 * 1024) // Bytes hashed at each sample point of the source file
+#define FINGERPRINT_SAMPLES 3              // Sample points: start, middle and end of the file
+
+// snapshot_read() errors
+#define SNAPSHOT_NOT_SNAPSHOT 1
+#define SNAPSHOT_UNSUPPORTED 2
+#define SNAPSHOT_TRUNCATED 3
+
+struct snapshot_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;    // sizeof(struct snapshot_header), for forward compatibility
+  int32_t period;          // Bins per histogram
+  int32_t resolution;      // ps per bin
+  int32_t channel_count;
+  int32_t source_count;    // Number of captures summed into this snapshot
+  uint64_t fingerprint;    // Source-file fingerprint (combine_fingerprints of the sources after a merge)
+  uint64_t total_events;
+};
+
+struct snapshot_channel
+{
+  int32_t channel;
+  int32_t reserved;
+  uint64_t events;
+};
+
+struct histogram_snapshot
+{
+  struct snapshot_header header;
+  struct snapshot_channel *channels;
+  int *counts; // channel_count * period
+};
+
+// Function to hash bytes with 64-bit FNV-1a, continuing from hash
+uint64_t fnv1a_64(uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Function to fold a merged source's fingerprint into a snapshot's with a multiply-rotate mix. Unlike XOR,
+// merging equal fingerprints does not cancel to 0, which stands for "no fingerprint".
+uint64_t combine_fingerprints(uint64_t hash, uint64_t fingerprint)
+{
+  hash *= 0x9E3779B97F4A7C15ULL;
+  hash = (hash << 31) | (hash >> 33);
+  return hash + fingerprint * 0xBF58476D1CE4E5B9ULL;
+}
+
+// Function to fingerprint a file from its size and a few sampled blocks, without reading all of it
+uint64_t file_fingerprint(const char *filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+  struct stat info;
+  fstat(fd, &info);
+
+  uint64_t hash = 14695981039346656037ULL;
+  int64_t size = info.st_size;
+  hash = fnv1a_64(hash, &size, sizeof(size));
+
+  char *block = malloc(FINGERPRINT_SAMPLE_SIZE);
+  if (!block)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int i = 0; i < FINGERPRINT_SAMPLES; i++)
+  {
+    off_t offset = (size - FINGERPRINT_SAMPLE_SIZE) / (FINGERPRINT_SAMPLES - 1) * i;
+    ssize_t bytes = pread(fd, block, FINGERPRINT_SAMPLE_SIZE, offset > 0 ? offset : 0);
+    if (bytes > 0)
+    {
+      hash = fnv1a_64(hash, block, bytes);
+    }
+  }
+  free(block);
+  close(fd);
+  return hash;
+}
+
+void snapshot_init(struct histogram_snapshot *snapshot, int period, int resolution)
+{
+  memset(snapshot, 0, sizeof(*snapshot));
+  memcpy(snapshot->header.magic, SNAPSHOT_MAGIC, 8);
+  snapshot->header.version = SNAPSHOT_VERSION;
+  snapshot->header.header_size = sizeof(struct snapshot_header);
+  snapshot->header.period = period;
+  snapshot->header.resolution = resolution;
+  snapshot->header.source_count = 1;
+}
+
+void snapshot_free(struct histogram_snapshot *snapshot)
+{
+  free(snapshot->channels);
+  free(snapshot->counts);
+}
+
+// Function to return the histogram of a channel, adding an empty one if the channel is new
+int *snapshot_channel_histogram(struct histogram_snapshot *snapshot, int32_t channel)
+{
+  int count = snapshot->header.channel_count;
+  int period = snapshot->header.period;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (snapshot->channels[i].channel == channel)
+    {
+      return snapshot->counts + (size_t)i * period;
+    }
+  }
+
+  snapshot->channels = realloc(snapshot->channels, (count + 1) * sizeof(struct snapshot_channel));
+  snapshot->counts = realloc(snapshot->counts, (size_t)(count + 1) * period * sizeof(int));
+  if (!snapshot->channels || !snapshot->counts)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  snapshot->channels[count].channel = channel;
+  snapshot->channels[count].reserved = 0;
+  snapshot->channels[count].events = 0;
+  memset(snapshot->counts + (size_t)count * period, 0, period * sizeof(int));
+  snapshot->header.channel_count++;
+  return snapshot->counts + (size_t)count * period;
+}
+
+// Function to populate per-channel snapshot histograms (at the snapshot's resolution) from any time-tag source
+void fill_snapshot_from_source(struct tag_source *source, struct histogram_snapshot *snapshot)
+{
+  struct time_tag tags[TAG_BLOCK_SIZE];
+  size_t count;
+  int32_t last_channel = -1;
+  int *histogram = NULL;
+  uint64_t *events = NULL;
+  int resolution = snapshot->header.resolution;
+
+  while ((count = source->read(source->context, tags, TAG_BLOCK_SIZE)) > 0)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (!histogram || tags[i].channel != last_channel)
+      {
+        histogram = snapshot_channel_histogram(snapshot, tags[i].channel);
+        events = &snapshot->channels[(histogram - snapshot->counts) / snapshot->header.period].events;
+        last_channel = tags[i].channel;
+      }
+      int mod_timestamp = window_bin(tags[i].timestamp);
+      histogram[resolution == 1 ? mod_timestamp : mod_timestamp / resolution]++;
+      (*events)++;
+    }
+    snapshot->header.total_events += count;
+  }
+}
+
+// Function to sum all channels of a snapshot into one histogram
+void snapshot_combined_histogram(const struct histogram_snapshot *snapshot, int *histogram)
+{
+  int period = snapshot->header.period;
+  memset(histogram, 0, period * sizeof(int));
+  for (int i = 0; i < snapshot->header.channel_count; i++)
+  {
+    add_histograms(histogram, snapshot->counts + (size_t)i * period, period);
+  }
+}
+
+// Function to write the snapshot layout to an open file
+void snapshot_write(const struct histogram_snapshot *snapshot, int fd)
+{
+  int count = snapshot->header.channel_count;
+  write_all(fd, &snapshot->header, sizeof(snapshot->header));
+  write_all(fd, snapshot->channels, count * sizeof(struct snapshot_channel));
+  write_all(fd, snapshot->counts, (size_t)count * snapshot->header.period * sizeof(int));
+}
+
+// Function to write a snapshot file
+void snapshot_save(const struct histogram_snapshot *snapshot, const char *filename)
+{
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    printf("Error: Could not create file %s\n", filename);
+    exit(1);
+  }
+  snapshot_write(snapshot, fd);
+  close(fd);
+}
+
+// Function to report whether a file starts with the snapshot magic
+int is_snapshot_file(const char *filename)
+{
+  char magic[8];
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  ssize_t bytes = read(fd, magic, sizeof(magic));
+  close(fd);
+  return bytes == sizeof(magic) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+}
+
+// Function to read a snapshot from an open file. Returns 0 on success, SNAPSHOT_NOT_SNAPSHOT,
+// SNAPSHOT_UNSUPPORTED or SNAPSHOT_TRUNCATED otherwise (the snapshot is then left empty).
+int snapshot_read(struct histogram_snapshot *snapshot, FILE *file)
+{
+  memset(snapshot, 0, sizeof(*snapshot));
+  struct snapshot_header *header = &snapshot->header;
+  if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0)
+  {
+    return SNAPSHOT_NOT_SNAPSHOT;
+  }
+  // Histograms are analyzed in WINDOW_SIZE ps buffers, so the bins must tile exactly that period
+  if (header->version != SNAPSHOT_VERSION || header->header_size < sizeof(*header) || header->resolution <= 0 ||
+      1000 % header->resolution != 0 || header->period <= 0 || header->period > WINDOW_SIZE ||
+      header->period * header->resolution != WINDOW_SIZE || header->channel_count < 0)
+  {
+    return SNAPSHOT_UNSUPPORTED;
+  }
+
+  // At most WINDOW_SIZE bins per channel, so the sizes below fit in 64 bits; they must also fit in the file
+  struct stat info;
+  size_t count = header->channel_count;
+  size_t bins = count * header->period;
+  if (fstat(fileno(file), &info) != 0 ||
+      (uint64_t)info.st_size < header->header_size + count * sizeof(struct snapshot_channel) + bins * sizeof(int))
+  {
+    return SNAPSHOT_TRUNCATED;
+  }
+  fseek(file, header->header_size, SEEK_SET);
+  snapshot->channels = malloc((count ? count : 1) * sizeof(struct snapshot_channel));
+  snapshot->counts = malloc((bins ? bins : 1) * sizeof(int));
+  if (!snapshot->channels || !snapshot->counts)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  if (fread(snapshot->channels, sizeof(struct snapshot_channel), count, file) != count ||
+      fread(snapshot->counts, sizeof(int), bins, file) != bins)
+  {
+    snapshot_free(snapshot);
+    memset(snapshot, 0, sizeof(*snapshot));
+    return SNAPSHOT_TRUNCATED;
+  }
+  return 0;
+}
+
+// Function to read a snapshot file, exits on a malformed or unsupported file
+void snapshot_load(struct histogram_snapshot *snapshot, const char *filename)
+{
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+
+  int error = snapshot_read(snapshot, file);
+  if (error == SNAPSHOT_NOT_SNAPSHOT)
+  {
+    printf("Error: %s is not a histogram snapshot\n", filename);
+    exit(1);
+  }
+  if (error == SNAPSHOT_UNSUPPORTED)
+  {
+    printf("Error: Unsupported snapshot (version %u, period %d, resolution %d) in %s\n", snapshot->header.version,
+           snapshot->header.period, snapshot->header.resolution, filename);
+    exit(1);
+  }
+  if (error == SNAPSHOT_TRUNCATED)
+  {
+    printf("Error: Truncated snapshot %s\n", filename);
+    exit(1);
+  }
+  fclose(file);
+}
+
+// Function to sum every `factor` consecutive bins into one; exact, and coarse may be the same array as fine
+void rebin_histogram(const int *fine, int fine_bins, int factor, int *coarse)
+{
+  for (int j = 0; j < fine_bins / factor; j++)
+  {
+    int sum = 0;
+    for (int k = 0; k < factor; k++)
+    {
+      sum += fine[j * factor + k];
+    }
+    coarse[j] = sum;
+  }
+}
+
+// Function to rebin every channel of a snapshot to a coarser resolution (a multiple of the current one)
+void snapshot_rebin(struct histogram_snapshot *snapshot, int resolution)
+{
+  int factor = resolution / snapshot->header.resolution;
+  int period = snapshot->header.period;
+  if (factor <= 1 || resolution % snapshot->header.resolution != 0)
+  {
+    return;
+  }
+  for (int i = 0; i < snapshot->header.channel_count; i++)
+  {
+    rebin_histogram(snapshot->counts + (size_t)i * period, period, factor, snapshot->counts + (size_t)i * (period / factor));
+  }
+  snapshot->header.period = period / factor;
+  snapshot->header.resolution = resolution;
+}
+
+// Function to add snapshot src into dst, channel by channel; the finer of the two is rebinned to the coarser
+void snapshot_merge(struct histogram_snapshot *dst, const struct histogram_snapshot *src)
+{
+  int src_resolution = src->header.resolution, dst_resolution = dst->header.resolution;
+  int coarse = src_resolution > dst_resolution ? src_resolution : dst_resolution;
+  if (dst->header.period * dst_resolution != src->header.period * src_resolution || coarse % src_resolution != 0 ||
+      coarse % dst_resolution != 0)
+  {
+    printf("Error: Cannot merge snapshots with period/resolution %d/%d and %d/%d\n", dst->header.period,
+           dst->header.resolution, src->header.period, src->header.resolution);
+    exit(1);
+  }
+  snapshot_rebin(dst, coarse);
+
+  int factor = coarse / src_resolution;
+  int *rebinned = malloc(dst->header.period * sizeof(int));
+  if (!rebinned)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int i = 0; i < src->header.channel_count; i++)
+  {
+    int *histogram = snapshot_channel_histogram(dst, src->channels[i].channel);
+    int index = (int)((histogram - dst->counts) / dst->header.period);
+    rebin_histogram(src->counts + (size_t)i * src->header.period, src->header.period, factor, rebinned);
+    add_histograms(histogram, rebinned, dst->header.period);
+    dst->channels[index].events += src->channels[i].events;
+  }
+  free(rebinned);
+  dst->header.total_events += src->header.total_events;
+  dst->header.source_count += src->header.source_count;
+  dst->header.fingerprint = combine_fingerprints(dst->header.fingerprint, src->header.fingerprint);
+}
+
+// Function to split a window into C1, D1 and C2 (without guard bands) and calculate BER1 and Visibility1
+void calculate_window_metrics(int histogram[], int start_index, int window_size, double *BER1, double *V1)
+{
+  // Divide the window into 3 equal parts (without guard bands)
+  int part_size = window_size / 3;
+  int C1 = 0, D1 = 0, C2 = 0;
+
+  for (int i = start_index; i < start_index + window_size; i++)
+  {
+    if (i < start_index + part_size)
+    {
+      C1 += histogram[i];
+    }
+    else if (i < start_index + 2 * part_size)
+    {
+      D1 += histogram[i];
+    }
+    else
+    {
+      C2 += histogram[i];
+    }
+  }
+
+  // Calculate BER and visibility
+  *BER1 = (double)D1 / (C1 + D1 + C2);
+  *V1 = (double)(C1 + C2) / D1;
+}
+
+// Function to find max sum window and calculate BER1 and Visibility1
+double find_max_sum_window(int histogram[], int size, int window_size, double *BER1, double *V1)
+{
+  int max_sum = 0;
+  int current_sum = 0;
+  int start_index = 0;
+
+  if (window_size > size)
+  {
+    return -1;
+  }
+
+  // Calculate the sum of the first window
+  for (int i = 0; i < window_size; i++)
+  {
+    current_sum += histogram[i];
+  }
+
+  max_sum = current_sum;
+
+  // Slide the window and update the sum
+  for (int i = window_size; i < size; i++)
+  {
+    current_sum += histogram[i] - histogram[i - window_size];
+    if (current_sum > max_sum)
+    {
+      max_sum = current_sum;
+      start_index = i - window_size + 1;
+    }
+  }
+
+  calculate_window_metrics(histogram, start_index, window_size, BER1, V1);
+
+  return start_index;
+}
+
+// Function to find the same window as find_max_sum_window using per-block sums of the histogram
+// (block_sums[j] = sum of bins j * PEAK_BLOCK .. (j + 1) * PEAK_BLOCK - 1). Every start position in a
+// block shares one upper bound, so blocks that cannot reach the best sum found so far are skipped.
+// On a peaked histogram only a handful of blocks are scanned bin by bin.
+int find_max_sum_window_pruned(int histogram[], const int block_sums[], int size, int window_size, double *BER1, double *V1)
+{
+  int last_start = size - window_size;
+  int blocks = (size + PEAK_BLOCK - 1) / PEAK_BLOCK;
+  int start_blocks = last_start / PEAK_BLOCK + 1;
+  int span = (window_size - 1) / PEAK_BLOCK + 2; // Blocks touched by windows starting in one block
+  int bounds[(WINDOW_SIZE + PEAK_BLOCK - 1) / PEAK_BLOCK];
+
+  if (window_size > size)
+  {
+    return -1;
+  }
+
+  // Upper bound of every start block, and the most promising one
+  int bound = 0, best_block = 0;
+  for (int j = 0; j < span && j < blocks; j++)
+  {
+    bound += block_sums[j];
+  }
+  for (int j = 0; j < start_blocks; j++)
+  {
+    if (j > 0)
+    {
+      bound -= block_sums[j - 1];
+      bound += j + span - 1 < blocks ? block_sums[j + span - 1] : 0;
+    }
+    bounds[j] = bound;
+    if (bound > bounds[best_block])
+    {
+      best_block = j;
+    }
+  }
+
+  // Scan the most promising block first, then every block that could still match or beat it.
+  // Ties go to the lowest start index, as in find_max_sum_window.
+  int max_sum = -1, start_index = 0;
+  for (int pass = 0; pass <= start_blocks; pass++)
+  {
+    int j = pass == 0 ? best_block : pass - 1;
+    if ((pass > 0 && j == best_block) || bounds[j] < max_sum)
+    {
+      continue;
+    }
+
+    int first = j * PEAK_BLOCK;
+    int last = first + PEAK_BLOCK - 1 < last_start ? first + PEAK_BLOCK - 1 : last_start;
+    int full_end = (first + window_size) / PEAK_BLOCK; // First block not fully inside the window
+    int current_sum = 0;
+    for (int k = j; k < full_end; k++)
+    {
+      current_sum += block_sums[k];
+    }
+    for (int i = full_end * PEAK_BLOCK; i < first + window_size; i++)
+    {
+      current_sum += histogram[i];
+    }
+
+    for (int s = first; s <= last; s++)
+    {
+      if (s > first)
+      {
+        current_sum += histogram[s + window_size - 1] - histogram[s - 1];
+      }
+      if (current_sum > max_sum || (current_sum == max_sum && s < start_index))
+      {
+        max_sum = current_sum;
+        start_index = s;
+      }
+    }
+  }
+
+  calculate_window_metrics(histogram, start_index, window_size, BER1, V1);
+  return start_index;
+}
+
+// Function to fill the prefix-sum table of a histogram: prefix[i] = histogram[0] + ... + histogram[i - 1]
+void build_prefix_sums(const int histogram[], int size, int64_t prefix[])
+{
+  prefix[0] = 0;
+  for (int i = 0; i < size; i++)
+  {
+    prefix[i + 1] = prefix[i] + histogram[i];
+  }
+}
+
+// Function to find the same window as find_max_sum_window from a prefix-sum table; every window sum and
+// the C1/D1/C2 split are two table lookups each
+int find_max_sum_window_prefix(const int64_t prefix[], int size, int window_size, double *BER1, double *V1)
+{
+  if (window_size > size)
+  {
+    return -1;
+  }
+
+  int64_t max_sum = prefix[window_size] - prefix[0];
+  int start_index = 0;
+  for (int s = 1; s + window_size <= size; s++)
+  {
+    int64_t sum = prefix[s + window_size] - prefix[s];
+    if (sum > max_sum)
+    {
+      max_sum = sum;
+      start_index = s;
+    }
+  }
+
+  int part_size = window_size / 3;
+  int64_t C1 = prefix[start_index + part_size] - prefix[start_index];
+  int64_t D1 = prefix[start_index + 2 * part_size] - prefix[start_index + part_size];
+  int64_t C2 = prefix[start_index + window_size] - prefix[start_index + 2 * part_size];
+
+  *BER1 = (double)D1 / (C1 + D1 + C2);
+  *V1 = (double)(C1 + C2) / D1;
+  return start_index;
+}
+
+// Function to decide whether bin i of a window ending at last_bin_index falls in a guard band
+int is_in_guard_band(int i, int last_bin_index, int guard_band)
+{
+  int half_guard_band = (int)guard_band / 2;
+
+  // First bin: only remove timestamps from the last half_guard_band ps
+  if (i == 0 && (i % 1000) > (1000 - half_guard_band))
+  {
+    return 1; // Skip last half_guard_band ps of the first bin
+  }
+
+  // Last bin: only remove timestamps from the first half_guard_band ps
+  if (i == last_bin_index && (i % 1000) < half_guard_band)
+  {
+    return 1; // Skip first half_guard_band ps of the last bin
+  }
+
+  // Skip timestamps in the guard band
+  return (i % 1000) < half_guard_band || (i % 1000) > (1000 - half_guard_band);
+}
+
+// Function to apply guard bands to a histogram of `resolution` ps bins, or of 1/`subdivisions` ps bins, and
+// calculate BER2 and Visibility2. A coarse bin is inside the guard band when its centre is; a sub-ps bin when
+// the picosecond it belongs to is.
+void apply_guard_bands_at_resolution(int histogram[], int start_index, int window_size, double *BER2, double *V2,
+                                     int guard_band, int resolution, int subdivisions)
+{
+  int part_size = window_size / 3;
+  int C1 = 0, D1 = 0, C2 = 0;
+  int last_bin_index = start_index + window_size - 1;
+
+  // Apply guard bands (ignore the first and last 100ps of each 1ns bin)
+  for (int i = start_index; i <= last_bin_index; i++)
+  {
+    // If within the guard band, skip the timestamp
+    if (is_in_guard_band((i * resolution + resolution / 2) / subdivisions,
+                         (last_bin_index * resolution + resolution / 2) / subdivisions, guard_band))
+    {
+      continue;
+    }
+
+    // Otherwise, accumulate counts
+    if (i < start_index + part_size)
+    {
+      C1 += histogram[i];
+    }
+    else if (i < start_index + 2 * part_size)
+    {
+      D1 += histogram[i];
+    }
+    else
+    {
+      C2 += histogram[i];
+    }
+  }
+
+  // Calculate BER and visibility after applying guard bands (guarding the integer division for sparse slices)
+  *BER2 = (double)D1 / (C1 + D1 + C2);
+  *V2 = D1 > 0 ? (C1 + C2) / D1 : (double)(C1 + C2) / D1;
+}
+
+// Function to apply guard bands and calculate BER2 and Visibility2
+void apply_guard_bands_and_calculate(int histogram[], int start_index, int window_size, double *BER2, double *V2, int guard_band)
+{
+  apply_guard_bands_at_resolution(histogram, start_index, window_size, BER2, V2, guard_band, 1, 1);
+}
+
+// Function to loop through different guard bands and find optimal values (bins as in apply_guard_bands_at_resolution)
+void search_optimal_guard_bands(int histogram[], int start_index, int window_size, int resolution, int subdivisions,
+                                int *optimal_BER_guard_band, double *min_BER, int *optimal_visibility_guard_band,
+                                double *max_visibility)
+{
+  *min_BER = 1.0;        // Initialize with max possible BER (1)
+  *max_visibility = 0.0; // Initialize with min possible Visibility (0)
+  *optimal_BER_guard_band = 0;
+  *optimal_visibility_guard_band = 0;
+
+  // Loop through guard band widths
+  for (int guard_band = MIN_GUARD_BAND; guard_band <= MAX_GUARD_BAND; guard_band += GUARD_BAND_STEP)
+  {
+    double BER, visibility;
+
+    // Calculate BER and visibility for the current guard band
+    apply_guard_bands_at_resolution(histogram, start_index, window_size, &BER, &visibility, guard_band, resolution,
+                                    subdivisions);
+
+    // Update minimum BER and corresponding guard band
+    if (BER < *min_BER)
+    {
+      *min_BER = BER;
+      *optimal_BER_guard_band = guard_band;
+    }
+
+    // Update maximum Visibility and corresponding guard band
+    if (visibility > *max_visibility)
+    {
+      *max_visibility = visibility;
+      *optimal_visibility_guard_band = guard_band;
+    }
+  }
+}
+
+// Function to print the result of search_optimal_guard_bands
+void print_optimal_guard_bands(int optimal_BER_guard_band, double min_BER, int optimal_visibility_guard_band,
+                               double max_visibility)
+{
+  printf("Optimal Guard Band for Minimum BER: %d ps with BER = %.5f\n", optimal_BER_guard_band, min_BER);
+  printf("Optimal Guard Band for Maximum Visibility: %d ps with Visibility = %.5f\n", optimal_visibility_guard_band, max_visibility);
+}
+
+// Function to search and print the optimal guard bands
+void find_optimal_guard_bands(int histogram[], int start_index, int window_size, int resolution, int subdivisions)
+{
+  int optimal_BER_guard_band, optimal_visibility_guard_band;
+  double min_BER, max_visibility;
+  search_optimal_guard_bands(histogram, start_index, window_size, resolution, subdivisions, &optimal_BER_guard_band,
+                             &min_BER, &optimal_visibility_guard_band, &max_visibility);
+  print_optimal_guard_bands(optimal_BER_guard_band, min_BER, optimal_visibility_guard_band, max_visibility);
+}
+
+// Function to estimate how far BER1/BER2 from a histogram of `resolution` ps bins can be from the 1 ps result.
+// At 1 ps the window may start anywhere inside the coarse start bin, so the events of the bins on both sides
+// of each slot boundary may belong to the neighbouring slot; for BER2, bins that are only partly inside a
+// guard band are uncertain as well. With U uncertain events out of N, a BER moves by at most U / (N - U).
+void report_resolution_error(int histogram[], int size, int start_index, int window_size, int resolution, int guard_band)
+{
+  int part_size = window_size / 3;
+  int last_bin_index = start_index + window_size - 1;
+  int64_t window_events = 0, kept_events = 0, boundary_events = 0, guard_events = 0;
+
+  for (int k = 0; k <= 3; k++)
+  {
+    int boundary = start_index + k * part_size;
+    boundary_events += (boundary > 0 ? histogram[boundary - 1] : 0) + (boundary < size ? histogram[boundary] : 0);
+  }
+  for (int i = start_index; i <= last_bin_index; i++)
+  {
+    int centre = i * resolution + resolution / 2;
+    int guarded = is_in_guard_band(centre, last_bin_index * resolution + resolution / 2, guard_band);
+    window_events += histogram[i];
+    kept_events += guarded ? 0 : histogram[i];
+    for (int ps = i * resolution; ps < (i + 1) * resolution; ps++)
+    {
+      if (is_in_guard_band(ps, last_bin_index * resolution + resolution / 2, guard_band) != guarded)
+      {
+        guard_events += histogram[i];
+        break;
+      }
+    }
+  }
+
+  double error1 = window_events > boundary_events ? (double)boundary_events / (window_events - boundary_events) : 1.0;
+  int64_t uncertain = boundary_events + guard_events;
+  double error2 = kept_events > uncertain ? (double)uncertain / (kept_events - uncertain) : 1.0;
+  printf("Resolution: %d ps bins (%d bins), BER1 within +-%lf and BER2 within +-%lf of the 1 ps result\n",
+         resolution, size, error1 > 1.0 ? 1.0 : error1, error2 > 1.0 ? 1.0 : error2);
+}
+
+/*
+  Confidence intervals
+
+  BER and visibility only depend on six counts of the peak window: the C1, D1 and C2 slots, each split
+  into events kept and events removed by the guard bands. Analytic intervals treat a BER as a binomial
+  proportion (Wilson score interval) and a visibility (C1 + C2) / D1 as (1 - q) / q of the binomial
+  proportion q = D1 / (C1 + D1 + C2), so its interval is the mapped Wilson interval of q.
+  The bootstrap resamples the six counts multinomially (conditional binomials, normal approximation
+  above BINOMIAL_EXACT_LIMIT expected events) and takes percentile intervals, so it never touches the
+  events again. Resamples are grouped into blocks of BOOTSTRAP_BLOCK, and every block draws from its own
+  splitmix64 stream seeded from --seed and the block number, so the result does not depend on the
+  number of threads or on scheduling. Visibility intervals use the exact ratio, not the truncated V2.
+*/
+
+#define BOOTSTRAP_BLOCK 64        // Resamples per RNG stream
+#define BINOMIAL_EXACT_LIMIT 30.0 // Below this expected count binomials are sampled exactly
+#define DEFAULT_CONFIDENCE 0.95
+
+// Counts of the peak window: [0] = C1, [1] = D1, [2] = C2
+struct window_counts
+{
+  int64_t kept[3];
+  int64_t guarded[3];
+};
+
+struct bootstrap_job
+{
+  const struct window_counts *counts;
+  int resamples;
+  uint64_t seed;
+  int next_block;           // Next block to claim, shared by all threads
+  pthread_mutex_t lock;
+  double *metrics[4];       // BER1, V1, BER2, V2 of every resample
+};
+
+// Function to classify bin i of a window: returns the part (0 = C1, 1 = D1, 2 = C2), or part + 3 if the bin
+// falls in a guard band
+int window_bin_class(int i, int start_index, int window_size, int guard_band, int resolution, int subdivisions)
+{
+  int part_size = window_size / 3;
+  int last_bin_index = start_index + window_size - 1;
+  int slot = i < start_index + part_size ? 0 : i < start_index + 2 * part_size ? 1 : 2;
+  int guarded = is_in_guard_band((i * resolution + resolution / 2) / subdivisions,
+                                 (last_bin_index * resolution + resolution / 2) / subdivisions, guard_band);
+  return guarded ? slot + 3 : slot;
+}
+
+// Function to split the peak window into kept and guarded C1/D1/C2 counts (bins as in apply_guard_bands_at_resolution)
+void count_window_events(int histogram[], int start_index, int window_size, int guard_band, int resolution,
+                         int subdivisions, struct window_counts *counts)
+{
+  memset(counts, 0, sizeof(*counts));
+  for (int i = start_index; i < start_index + window_size; i++)
+  {
+    int class = window_bin_class(i, start_index, window_size, guard_band, resolution, subdivisions);
+    if (class >= 3)
+    {
+      counts->guarded[class - 3] += histogram[i];
+    }
+    else
+    {
+      counts->kept[class] += histogram[i];
+    }
+  }
+}
+
+// Function to compute BER1, V1, BER2 and V2 (exact ratio) from window counts
+void window_counts_metrics(const int64_t kept[3], const int64_t guarded[3], double metrics[4])
+{
+  double C1 = kept[0] + guarded[0], D1 = kept[1] + guarded[1], C2 = kept[2] + guarded[2];
+  metrics[0] = D1 / (C1 + D1 + C2);
+  metrics[1] = (C1 + C2) / D1;
+  metrics[2] = (double)kept[1] / (kept[0] + kept[1] + kept[2]);
+  metrics[3] = (double)(kept[0] + kept[2]) / kept[1];
+}
+
+// Function to return the standard normal quantile for a two-sided confidence level
+double normal_quantile(double level)
+{
+  double target = (1.0 - level) / 2.0, low = 0.0, high = 10.0;
+  for (int i = 0; i < 100; i++)
+  {
+    double middle = (low + high) / 2;
+    if (0.5 * erfc(middle / sqrt(2.0)) > target)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  return (low + high) / 2;
+}
+
+// Function to compute the Wilson score interval of successes / trials
+void wilson_interval(double successes, double trials, double z, double *low, double *high)
+{
+  if (trials <= 0)
+  {
+    *low = 0.0;
+    *high = 1.0;
+    return;
+  }
+  double p = successes / trials, z2 = z * z;
+  double centre = (p + z2 / (2 * trials)) / (1 + z2 / trials);
+  double half = z * sqrt(p * (1 - p) / trials + z2 / (4 * trials * trials)) / (1 + z2 / trials);
+  *low = centre - half > 0 ? centre - half : 0.0;
+  *high = centre + half < 1 ? centre + half : 1.0;
+}
+
+// Function to map the interval of q = D / (C + D) to the interval of V = C / D = (1 - q) / q
+void visibility_interval(double q_low, double q_high, double *low, double *high)
+{
+  *low = q_high > 0 ? (1 - q_high) / q_high : INFINITY;
+  *high = q_low > 0 ? (1 - q_low) / q_low : INFINITY;
+}
+
+uint64_t splitmix64_next(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Function to return a uniform double in (0, 1)
+double random_uniform(uint64_t *state)
+{
+  return ((splitmix64_next(state) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Function to draw from Binomial(n, p): exactly by geometric waiting times for small expected counts,
+// from the normal approximation otherwise
+int64_t random_binomial(uint64_t *state, int64_t n, double p)
+{
+  if (n <= 0 || p <= 0.0)
+  {
+    return 0;
+  }
+  if (p >= 1.0)
+  {
+    return n;
+  }
+  if (p > 0.5)
+  {
+    return n - random_binomial(state, n, 1.0 - p);
+  }
+  if (n * p < BINOMIAL_EXACT_LIMIT)
+  {
+    double log_q = log1p(-p);
+    // position is the trial of the latest success; count those among trials 1..n
+    int64_t successes = -1;
+    double position = 0;
+    while (position <= n)
+    {
+      position += floor(log(random_uniform(state)) / log_q) + 1;
+      successes++;
+    }
+    return successes;
+  }
+  double gaussian = sqrt(-2.0 * log(random_uniform(state))) * cos(2.0 * M_PI * random_uniform(state));
+  double sample = floor(n * p + sqrt(n * p * (1 - p)) * gaussian + 0.5);
+  return sample < 0 ? 0 : sample > n ? n : (int64_t)sample;
+}
+
+#define BINOMIAL_CHECK_DRAWS 200000 // Draws per (n, p) of --check-binomial
+
+// Function to compare the sample mean and variance of random_binomial with n * p and n * p * (1 - p) for small
+// n, on both sides of the p > 0.5 reflection (--check-binomial). Returns 0 if every case is within 5 standard
+// errors.
+int check_random_binomial(void)
+{
+  const int64_t sizes[] = {1, 2, 4, 10, 30};
+  const double probabilities[] = {0.05, 0.25, 0.3, 0.5, 0.7, 0.95};
+  uint64_t state = 1;
+  int failures = 0;
+
+  printf("n,p,mean,expected_mean,variance,expected_variance,result\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    for (size_t j = 0; j < sizeof(probabilities) / sizeof(probabilities[0]); j++)
+    {
+      int64_t n = sizes[i];
+      double p = probabilities[j], sum = 0, sum_squares = 0;
+      for (int d = 0; d < BINOMIAL_CHECK_DRAWS; d++)
+      {
+        double x = (double)random_binomial(&state, n, p);
+        sum += x;
+        sum_squares += x * x;
+      }
+      double mean = sum / BINOMIAL_CHECK_DRAWS;
+      double variance = sum_squares / BINOMIAL_CHECK_DRAWS - mean * mean;
+      double expected_mean = n * p, expected_variance = n * p * (1 - p);
+
+      // Standard errors of the mean and (approximately) of the variance, from the fourth central moment; the
+      // variance also shifts by the squared error of the mean, which dominates when mu4 = sigma^4 (n = 1, p = 0.5)
+      double mean_error = sqrt(expected_variance / BINOMIAL_CHECK_DRAWS);
+      double fourth = expected_variance * (1 + 3 * (n - 2) * p * (1 - p));
+      double variance_error = sqrt(fabs(fourth - expected_variance * expected_variance) / BINOMIAL_CHECK_DRAWS) +
+                              5 * mean_error * mean_error;
+      int ok = fabs(mean - expected_mean) <= 5 * mean_error && fabs(variance - expected_variance) <= 5 * variance_error;
+      failures += !ok;
+      printf("%lld,%.2f,%.5f,%.5f,%.5f,%.5f,%s\n", (long long)n, p, mean, expected_mean, variance,
+             expected_variance, ok ? "ok" : "FAIL");
+    }
+  }
+  printf("Binomial check: %s\n", failures ? "FAILED" : "passed");
+  return failures ? 1 : 0;
+}
+
+void *bootstrap_thread(void *argument)
+{
+  struct bootstrap_job *job = argument;
+  const int64_t *kept = job->counts->kept, *guarded = job->counts->guarded;
+  int64_t categories[6] = {kept[0], kept[1], kept[2], guarded[0], guarded[1], guarded[2]};
+  int64_t total = 0;
+  for (int k = 0; k < 6; k++)
+  {
+    total += categories[k];
+  }
+
+  for (;;)
+  {
+    pthread_mutex_lock(&job->lock);
+    int block = job->next_block++;
+    pthread_mutex_unlock(&job->lock);
+    if (block * BOOTSTRAP_BLOCK >= job->resamples)
+    {
+      return NULL;
+    }
+
+    uint64_t state = job->seed ^ (0xD1B54A32D192ED03ULL * (uint64_t)(block + 1));
+    for (int r = block * BOOTSTRAP_BLOCK; r < job->resamples && r < (block + 1) * BOOTSTRAP_BLOCK; r++)
+    {
+      // Multinomial(total, categories / total) as a chain of conditional binomials
+      int64_t sample[6], remaining = total, remaining_mass = total;
+      for (int k = 0; k < 6; k++)
+      {
+        sample[k] = k == 5 ? remaining : random_binomial(&state, remaining, remaining_mass > 0 ? (double)categories[k] / remaining_mass : 0.0);
+        remaining -= sample[k];
+        remaining_mass -= categories[k];
+      }
+      double metrics[4];
+      window_counts_metrics(sample, sample + 3, metrics);
+      for (int m = 0; m < 4; m++)
+      {
+        job->metrics[m][r] = metrics[m];
+      }
+    }
+  }
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Function to print analytic and (with resamples > 0) bootstrap intervals of BER1, V1, BER2 and V2
+void report_confidence_intervals(const struct window_counts *counts, double level, int resamples, int threads, uint64_t seed)
+{
+  const char *names[4] = {"BER1", "V1", "BER2", "V2"};
+  double z = normal_quantile(level);
+  double C1 = counts->kept[0] + counts->guarded[0], D1 = counts->kept[1] + counts->guarded[1];
+  double C2 = counts->kept[2] + counts->guarded[2];
+  double kept = counts->kept[0] + counts->kept[1] + counts->kept[2];
+  double low[4], high[4];
+
+  wilson_interval(D1, C1 + D1 + C2, z, &low[0], &high[0]);
+  visibility_interval(low[0], high[0], &low[1], &high[1]);
+  wilson_interval(counts->kept[1], kept, z, &low[2], &high[2]);
+  visibility_interval(low[2], high[2], &low[3], &high[3]);
+  printf("Confidence %.1f%% (analytic):", level * 100);
+  for (int m = 0; m < 4; m++)
+  {
+    printf(" %s [%lf, %lf]", names[m], low[m], high[m]);
+  }
+  printf("\n");
+
+  if (resamples <= 0)
+  {
+    return;
+  }
+  struct timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  struct bootstrap_job job;
+  job.counts = counts;
+  job.resamples = resamples;
+  job.seed = seed;
+  job.next_block = 0;
+  pthread_mutex_init(&job.lock, NULL);
+  for (int m = 0; m < 4; m++)
+  {
+    job.metrics[m] = malloc(resamples * sizeof(double));
+    if (!job.metrics[m])
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+
+  int blocks = (resamples + BOOTSTRAP_BLOCK - 1) / BOOTSTRAP_BLOCK;
+  int workers = threads < blocks ? threads : blocks;
+  pthread_t *ids = malloc(workers * sizeof(pthread_t));
+  for (int t = 0; t < workers; t++)
+  {
+    if (pthread_create(&ids[t], NULL, bootstrap_thread, &job) != 0)
+    {
+      printf("Error: Could not start worker thread\n");
+      exit(1);
+    }
+  }
+  for (int t = 0; t < workers; t++)
+  {
+    pthread_join(ids[t], NULL);
+  }
+
+  // Percentile intervals (NaN resamples, e.g. D1 = 0, sort last and are excluded)
+  for (int m = 0; m < 4; m++)
+  {
+    int valid = 0;
+    for (int r = 0; r < resamples; r++)
+    {
+      if (!isnan(job.metrics[m][r]))
+      {
+        job.metrics[m][valid++] = job.metrics[m][r];
+      }
+    }
+    qsort(job.metrics[m], valid, sizeof(double), compare_doubles);
+    int first = (int)floor((1.0 - level) / 2 * (valid - 1));
+    int last = (int)ceil((1.0 + level) / 2 * (valid - 1));
+    low[m] = valid > 0 ? job.metrics[m][first] : NAN;
+    high[m] = valid > 0 ? job.metrics[m][last] : NAN;
+    free(job.metrics[m]);
+  }
+  printf("Confidence %.1f%% (bootstrap, %d resamples, %d threads, %.2f ms):", level * 100, resamples, workers,
+         seconds_since(&begin) * 1e3);
+  for (int m = 0; m < 4; m++)
+  {
+    printf(" %s [%lf, %lf]", names[m], low[m], high[m]);
+  }
+  printf("\n");
+  pthread_mutex_destroy(&job.lock);
+  free(ids);
+}
+
+/*
+  Per-time-slice BER/visibility series
+
+  The capture is cut into fixed slices of timestamp time (e.g. 100 ms = 1e11 ps). Every slice gets
+  its own histogram, and when a slice is closed BER1/V1/BER2/V2 are computed on it and printed as one
+  row. Up to SLICE_POOL_SIZE slices are open at once so events that straddle a boundary slightly out
+  of order still land in the right slice; opening a newer slice beyond that closes the oldest one.
+  Closed histograms are cleared and returned to a pool, so memory stays at SLICE_POOL_SIZE tiered
+  (64 KB) histograms plus one int histogram for the analysis, whatever the capture length. The stage
+  passes every tag through unchanged, so the whole-capture result is still computed in the same pass.
+*/
+
+#define SLICE_POOL_SIZE 4 // Slices kept open at once
+
+struct open_slice
+{
+  int64_t index; // Slice number: floor(timestamp / slice_width)
+  struct tiered_histogram histogram;
+  uint64_t count;
+};
+
+struct slice_series
+{
+  struct tag_source *upstream;
+  int64_t slice_width;                     // ps
+  struct open_slice open[SLICE_POOL_SIZE]; // Ordered by index
+  int open_count;
+  int64_t closed_limit;                    // Slices below this index have been closed
+  struct tiered_histogram pool[SLICE_POOL_SIZE]; // Cleared histograms ready for reuse
+  int pool_count;
+  int *analysis;                           // Expanded histogram of the slice being closed
+  uint64_t late_events;                    // Events for slices that were already closed
+  uint64_t slices;
+};
+
+void slice_series_init(struct slice_series *series, struct tag_source *upstream, int64_t slice_width)
+{
+  memset(series, 0, sizeof(*series));
+  series->upstream = upstream;
+  series->slice_width = slice_width;
+  series->closed_limit = INT64_MIN;
+  series->analysis = malloc(WINDOW_SIZE * sizeof(int));
+  if (!series->analysis)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+}
+
+// Function to analyze the oldest open slice, print its row and recycle its histogram
+void slice_series_close_oldest(struct slice_series *series)
+{
+  struct open_slice *slice = &series->open[0];
+  double BER1, V1, BER2, V2;
+
+  tiered_histogram_expand(&slice->histogram, series->analysis);
+  int start_index = find_max_sum_window(series->analysis, WINDOW_SIZE, 3000, &BER1, &V1);
+  apply_guard_bands_and_calculate(series->analysis, start_index, 3000, &BER2, &V2, GUARD_BAND);
+  printf("%s,%lld,%lld,%llu,%lf,%lf,%lf,%lf\n", GROUP, (long long)slice->index,
+         (long long)(slice->index * series->slice_width), (unsigned long long)slice->count, BER1, V1, BER2, V2);
+  series->slices++;
+  series->closed_limit = slice->index + 1;
+
+  tiered_histogram_clear(&slice->histogram);
+  series->pool[series->pool_count++] = slice->histogram;
+  series->open_count--;
+  memmove(&series->open[0], &series->open[1], series->open_count * sizeof(struct open_slice));
+}
+
+// Function to find (or open) the slice with the given index, NULL if it was already closed
+struct open_slice *slice_series_lookup(struct slice_series *series, int64_t index)
+{
+  int position = series->open_count;
+  for (int i = series->open_count - 1; i >= 0; i--)
+  {
+    if (series->open[i].index == index)
+    {
+      return &series->open[i];
+    }
+    if (series->open[i].index < index)
+    {
+      break;
+    }
+    position = i;
+  }
+
+  if (index < series->closed_limit)
+  {
+    return NULL;
+  }
+  if (series->open_count == SLICE_POOL_SIZE)
+  {
+    if (position == 0)
+    {
+      return NULL;
+    }
+    slice_series_close_oldest(series);
+    position--;
+  }
+
+  struct tiered_histogram histogram;
+  if (series->pool_count > 0)
+  {
+    histogram = series->pool[--series->pool_count];
+  }
+  else
+  {
+    tiered_histogram_init(&histogram);
+  }
+  memmove(&series->open[position + 1], &series->open[position], (series->open_count - position) * sizeof(struct open_slice));
+  series->open_count++;
+  series->open[position].index = index;
+  series->open[position].histogram = histogram;
+  series->open[position].count = 0;
+  return &series->open[position];
+}
+
+// tag_source read function: folds every tag into its slice and passes it through
+size_t slice_series_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct slice_series *series = context;
+  size_t count = series->upstream->read(series->upstream->context, tags, max_tags);
+  struct open_slice *slice = NULL;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    int64_t index = floor_div(tags[i].timestamp, series->slice_width);
+    if (!slice || slice->index != index)
+    {
+      slice = slice_series_lookup(series, index);
+      if (!slice)
+      {
+        series->late_events++;
+        continue;
+      }
+    }
+    tiered_histogram_add(&slice->histogram, window_bin(tags[i].timestamp));
+    slice->count++;
+  }
+
+  if (count == 0)
+  {
+    while (series->open_count > 0)
+    {
+      slice_series_close_oldest(series);
+    }
+  }
+  return count;
+}
+
+void slice_series_free(struct slice_series *series)
+{
+  for (int i = 0; i < series->open_count; i++)
+  {
+    tiered_histogram_free(&series->open[i].histogram);
+  }
+  for (int i = 0; i < series->pool_count; i++)
+  {
+    tiered_histogram_free(&series->pool[i]);
+  }
+  free(series->analysis);
+}
+
+/*
+  Sliding-window live histogram
+
+  For live monitoring the histogram covers only the last window_steps * step ps. Each sub-interval
+  of step ps has its own delta histogram in a ring, and the live histogram is their running sum:
+  an event increments its bin in both. When time moves into a new sub-interval, the ring slot that
+  falls out of the window is subtracted from the live histogram and cleared for reuse, which is one
+  vectorizable pass over WINDOW_SIZE bins per sub-interval, independent of the event rate. At every
+  sub-interval boundary the live BER1/V1/BER2/V2 and peak position are published as one row. Block
+  sums are maintained next to the bins so the peak search only rescans blocks that can hold the peak.
+  The deltas are tiered histograms, which halves the memory of the ring.
+*/
+
+#define LIVE_BLOCKS ((WINDOW_SIZE + PEAK_BLOCK - 1) / PEAK_BLOCK)
+
+struct sliding_histogram
+{
+  struct tag_source *upstream;
+  int64_t step;           // ps per sub-interval
+  int steps;              // Sub-intervals per window
+  int *live;              // Sum of all deltas in the ring
+  int *live_blocks;       // Per-PEAK_BLOCK sums of live, for the pruned peak search
+  struct tiered_histogram *deltas; // Ring of per-sub-interval histograms, slot = sub-interval % steps
+  int **delta_blocks;     // Per-PEAK_BLOCK sums of every delta
+  uint64_t *delta_counts; // Events per ring slot
+  uint64_t live_count;    // Events in the window
+  int64_t current;        // Newest sub-interval (floor(timestamp / step))
+  int started;
+  uint64_t late_events;   // Events older than the window
+  uint64_t publishes;
+  double publish_seconds; // Total time spent publishing
+};
+
+void sliding_histogram_init(struct sliding_histogram *sliding, struct tag_source *upstream, int64_t window, int64_t step)
+{
+  memset(sliding, 0, sizeof(*sliding));
+  sliding->upstream = upstream;
+  sliding->step = step;
+  sliding->steps = (int)((window + step - 1) / step);
+  sliding->live = calloc(WINDOW_SIZE, sizeof(int));
+  sliding->live_blocks = calloc(LIVE_BLOCKS, sizeof(int));
+  sliding->deltas = calloc(sliding->steps, sizeof(struct tiered_histogram));
+  sliding->delta_blocks = calloc(sliding->steps, sizeof(int *));
+  sliding->delta_counts = calloc(sliding->steps, sizeof(uint64_t));
+  if (!sliding->live || !sliding->live_blocks || !sliding->deltas || !sliding->delta_blocks || !sliding->delta_counts)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int i = 0; i < sliding->steps; i++)
+  {
+    tiered_histogram_init(&sliding->deltas[i]);
+    sliding->delta_blocks[i] = calloc(LIVE_BLOCKS, sizeof(int));
+    if (!sliding->delta_blocks[i])
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+}
+
+void sliding_histogram_free(struct sliding_histogram *sliding)
+{
+  for (int i = 0; i < sliding->steps; i++)
+  {
+    tiered_histogram_free(&sliding->deltas[i]);
+    free(sliding->delta_blocks[i]);
+  }
+  free(sliding->deltas);
+  free(sliding->delta_blocks);
+  free(sliding->delta_counts);
+  free(sliding->live);
+  free(sliding->live_blocks);
+}
+
+// Function to compute and print the live metrics for the window ending with the current sub-interval
+void sliding_histogram_publish(struct sliding_histogram *sliding)
+{
+  struct timespec begin, end;
+  double BER1, V1, BER2, V2;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  int start_index = find_max_sum_window_pruned(sliding->live, sliding->live_blocks, WINDOW_SIZE, 3000, &BER1, &V1);
+  apply_guard_bands_and_calculate(sliding->live, start_index, 3000, &BER2, &V2, GUARD_BAND);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  sliding->publish_seconds += (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  sliding->publishes++;
+  printf("%s,live,%lld,%llu,%d,%lf,%lf,%lf,%lf\n", GROUP, (long long)((sliding->current + 1) * sliding->step),
+         (unsigned long long)sliding->live_count, start_index, BER1, V1, BER2, V2);
+}
+
+// Function to expire the ring slot of sub-interval `index - steps` so it can hold sub-interval `index`
+void sliding_histogram_expire(struct sliding_histogram *sliding, int64_t index)
+{
+  int slot = (int)(((index % sliding->steps) + sliding->steps) % sliding->steps);
+  int *live = sliding->live;
+  struct tiered_histogram *delta = &sliding->deltas[slot];
+  int *delta_blocks = sliding->delta_blocks[slot];
+
+  if (sliding->delta_counts[slot] == 0)
+  {
+    return;
+  }
+  for (int i = 0; i < WINDOW_SIZE; i++)
+  {
+    live[i] -= delta->bins[i];
+  }
+  if (delta->master)
+  {
+    for (int i = 0; i < WINDOW_SIZE; i++)
+    {
+      live[i] -= (int)delta->master[i];
+    }
+  }
+  tiered_histogram_clear(delta);
+  for (int j = 0; j < LIVE_BLOCKS; j++)
+  {
+    sliding->live_blocks[j] -= delta_blocks[j];
+    delta_blocks[j] = 0;
+  }
+  sliding->live_count -= sliding->delta_counts[slot];
+  sliding->delta_counts[slot] = 0;
+}
+
+// Function to move the window forward so that its newest sub-interval is `index`
+void sliding_histogram_advance(struct sliding_histogram *sliding, int64_t index)
+{
+  sliding_histogram_publish(sliding);
+
+  // After a gap longer than the window every slot is expired exactly once
+  int64_t first = index - sliding->current > sliding->steps ? index - sliding->steps + 1 : sliding->current + 1;
+  for (int64_t k = first; k <= index; k++)
+  {
+    sliding_histogram_expire(sliding, k);
+  }
+  sliding->current = index;
+}
+
+// tag_source read function: keeps the live histogram up to date and passes every tag through
+size_t sliding_histogram_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct sliding_histogram *sliding = context;
+  size_t count = sliding->upstream->read(sliding->upstream->context, tags, max_tags);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    int64_t index = floor_div(tags[i].timestamp, sliding->step);
+    if (!sliding->started)
+    {
+      sliding->started = 1;
+      sliding->current = index;
+    }
+    else if (index > sliding->current)
+    {
+      sliding_histogram_advance(sliding, index);
+    }
+    else if (index <= sliding->current - sliding->steps)
+    {
+      sliding->late_events++;
+      continue;
+    }
+
+    int slot = (int)(((index % sliding->steps) + sliding->steps) % sliding->steps);
+    int mod_timestamp = window_bin(tags[i].timestamp);
+    tiered_histogram_add(&sliding->deltas[slot], mod_timestamp);
+    sliding->delta_blocks[slot][mod_timestamp / PEAK_BLOCK]++;
+    sliding->delta_counts[slot]++;
+    sliding->live[mod_timestamp]++;
+    sliding->live_blocks[mod_timestamp / PEAK_BLOCK]++;
+    sliding->live_count++;
+  }
+
+  if (count == 0 && sliding->started)
+  {
+    // Publish the final, partially filled sub-interval once
+    sliding_histogram_publish(sliding);
+    sliding->started = 0;
+  }
+  return count;
+}
+
+/*
+  Exponentially-decaying histogram
+
+  A lighter live mode than the sliding window: every event is weighted by 2^((t - reference) / half_life),
+  so relative to the newest event an older one has decayed by 2^(-age / half_life). Instead of multiplying
+  every bin down as time passes, the weight of new events grows (lazy decay with a global scale); BER and
+  visibility are ratios and do not change under a common scale. When the weights reach
+  2^DECAY_RENORMALIZE_EXPONENT the bins are scaled back by that exact power of two and the reference moves
+  forward, which happens once per DECAY_RENORMALIZE_EXPONENT half-lives; after a longer gap the older weights
+  are negligible and the bins are cleared in one step. Weights come from a table of DECAY_TABLE_SIZE steps per
+  half-life, so an event costs one table lookup, one ldexpf and one add. The float bins take WINDOW_SIZE * 4 =
+  128 KB. Each publish rounds them into an int copy of the same size for the shared window analysis, so the
+  mode holds 256 KB in total. The copy scales the total weight to DECAY_ANALYSIS_COUNTS, so only bins holding
+  less than 2^-31 of the total weight round to 0.
+*/
+
+#define DECAY_TABLE_SIZE 1024        // Weight steps per half-life
+#define DECAY_RENORMALIZE_EXPONENT 64 // Renormalize once weights reach 2^64
+#define DECAY_ANALYSIS_COUNTS (1 << 30) // Total of the rounded counts the decayed bins are analyzed as
+
+struct decaying_histogram
+{
+  struct tag_source *upstream;
+  float *bins;                       // WINDOW_SIZE decayed counts, all scaled by the same factor
+  int *counts;                       // WINDOW_SIZE bins rounded for the analysis
+  double ticks_per_ps;               // DECAY_TABLE_SIZE / half_life
+  int64_t half_life;                 // ps
+  int64_t reference;                 // Time at which an event has weight 1
+  float steps[DECAY_TABLE_SIZE];     // 2^(k / DECAY_TABLE_SIZE)
+  double total;                      // Sum of all bins
+  int64_t publish_period;            // ps between published updates
+  int64_t next_publish;
+  int64_t newest;
+  int started;
+  uint64_t renormalizations;
+  uint64_t publishes;
+  double publish_seconds;
+};
+
+void decaying_histogram_init(struct decaying_histogram *decaying, struct tag_source *upstream, int64_t half_life, int64_t publish_period)
+{
+  memset(decaying, 0, sizeof(*decaying));
+  decaying->upstream = upstream;
+  decaying->half_life = half_life;
+  decaying->ticks_per_ps = (double)DECAY_TABLE_SIZE / half_life;
+  decaying->publish_period = publish_period;
+  decaying->bins = calloc(WINDOW_SIZE, sizeof(float));
+  decaying->counts = malloc(WINDOW_SIZE * sizeof(int));
+  if (!decaying->bins || !decaying->counts)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int k = 0; k < DECAY_TABLE_SIZE; k++)
+  {
+    decaying->steps[k] = (float)exp2((double)k / DECAY_TABLE_SIZE);
+  }
+}
+
+// Function to analyze a decayed histogram with find_max_sum_window and apply_guard_bands_and_calculate. The
+// weights are scaled to DECAY_ANALYSIS_COUNTS in total and rounded into counts, so the shared integer analysis
+// applies unchanged; the metrics are ratios and do not depend on the scale. Rounding moves every bin by at most
+// half a count, 2^-31 of the total weight, and drops bins below that.
+int analyze_decayed_histogram(const float histogram[], int counts[], int size, int window_size, int guard_band,
+                              double *BER1, double *V1, double *BER2, double *V2)
+{
+  double total = 0.0;
+  for (int i = 0; i < size; i++)
+  {
+    total += histogram[i];
+  }
+  double scale = total > 0.0 ? DECAY_ANALYSIS_COUNTS / total : 0.0;
+  for (int i = 0; i < size; i++)
+  {
+    counts[i] = (int)lround(histogram[i] * scale);
+  }
+
+  int start_index = find_max_sum_window(counts, size, window_size, BER1, V1);
+  apply_guard_bands_and_calculate(counts, start_index, window_size, BER2, V2, guard_band);
+  return start_index;
+}
+
+// Function to print the decayed metrics as of the newest event
+void decaying_histogram_publish(struct decaying_histogram *decaying)
+{
+  struct timespec begin, end;
+  double BER1, V1, BER2, V2;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  int start_index = analyze_decayed_histogram(decaying->bins, decaying->counts, WINDOW_SIZE, 3000, GUARD_BAND, &BER1, &V1, &BER2, &V2);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  decaying->publish_seconds += (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) * 1e-9;
+  decaying->publishes++;
+
+  // Effective event count: total weight expressed in units of an event at the newest timestamp
+  double effective = decaying->total * exp2(-(double)(decaying->newest - decaying->reference) / decaying->half_life);
+  printf("%s,decay,%lld,%.1f,%d,%lf,%lf,%lf,%lf\n", GROUP, (long long)decaying->newest, effective, start_index,
+         BER1, V1, BER2, V2);
+}
+
+// Function to scale all weights down by 2^DECAY_RENORMALIZE_EXPONENT and move the reference forward
+void decaying_histogram_renormalize(struct decaying_histogram *decaying)
+{
+  for (int i = 0; i < WINDOW_SIZE; i++)
+  {
+    decaying->bins[i] = ldexpf(decaying->bins[i], -DECAY_RENORMALIZE_EXPONENT);
+  }
+  decaying->total = ldexp(decaying->total, -DECAY_RENORMALIZE_EXPONENT);
+  decaying->reference += DECAY_RENORMALIZE_EXPONENT * decaying->half_life;
+  decaying->renormalizations++;
+}
+
+// Function to drop all weights and move the reference to timestamp, after a gap that decayed them to nothing
+void decaying_histogram_reset(struct decaying_histogram *decaying, int64_t timestamp)
+{
+  memset(decaying->bins, 0, WINDOW_SIZE * sizeof(float));
+  decaying->total = 0.0;
+  decaying->reference = timestamp;
+  decaying->renormalizations++;
+}
+
+// tag_source read function: folds every tag into the decayed histogram and passes it through
+size_t decaying_histogram_read(void *context, struct time_tag *tags, size_t max_tags)
+{
+  struct decaying_histogram *decaying = context;
+  size_t count = decaying->upstream->read(decaying->upstream->context, tags, max_tags);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    int64_t timestamp = tags[i].timestamp;
+    if (!decaying->started)
+    {
+      decaying->started = 1;
+      decaying->reference = timestamp;
+      decaying->newest = timestamp;
+      decaying->next_publish = (floor_div(timestamp, decaying->publish_period) + 1) * decaying->publish_period;
+    }
+    if (timestamp >= decaying->next_publish)
+    {
+      decaying_histogram_publish(decaying);
+      decaying->next_publish = (floor_div(timestamp, decaying->publish_period) + 1) * decaying->publish_period;
+    }
+    if (timestamp > decaying->newest)
+    {
+      decaying->newest = timestamp;
+    }
+
+    int64_t tick = (int64_t)floor((timestamp - decaying->reference) * decaying->ticks_per_ps);
+    if (tick >= 2 * (int64_t)DECAY_RENORMALIZE_EXPONENT * DECAY_TABLE_SIZE)
+    {
+      // After a gap of more than DECAY_RENORMALIZE_EXPONENT half-lives every older weight is below 2^-64 of
+      // this event's, so start over at this event instead of renormalizing once per 64 half-lives
+      decaying_histogram_reset(decaying, timestamp);
+      tick = 0;
+    }
+    else if (tick >= (int64_t)DECAY_RENORMALIZE_EXPONENT * DECAY_TABLE_SIZE)
+    {
+      decaying_histogram_renormalize(decaying);
+      tick -= (int64_t)DECAY_RENORMALIZE_EXPONENT * DECAY_TABLE_SIZE;
+    }
+    float weight = ldexpf(decaying->steps[tick & (DECAY_TABLE_SIZE - 1)], (int)floor_div(tick, DECAY_TABLE_SIZE));
+
+    decaying->bins[window_bin(timestamp)] += weight;
+    decaying->total += weight;
+  }
+
+  if (count == 0 && decaying->started)
+  {
+    decaying_histogram_publish(decaying);
+    decaying->started = 0;
+  }
+  return count;
+}
+
+// Command-line options; everything except the filename is optional
+struct options
+{
+  const char *filename;     // Input CSV file name (timestamps in picoseconds) or snapshot, inputs[0]
+  const char **inputs;      // All file names given on the command line
+  int input_count;
+  int external_sort;        // Sort the capture out of core before analysis
+  size_t sort_memory_mb;    // Memory budget of the external sorter
+  int threads;              // Worker threads (0 = one per online CPU)
+  const char *temp_dir;     // Directory for spilled runs
+  const char *sort_output;  // Optional binary time-tag file receiving the ingested stream
+  long long reorder_horizon; // Disorder tolerated by the reorder buffer in ps (0 = off)
+  int counter_bits;          // Width of a wrapping hardware counter (0 = timestamps do not wrap)
+  int overflow_channel;      // Channel of overflow records (-1 = infer wraps from the counter)
+  long long slice_width;     // Width of BER/visibility time slices in ps (0 = whole capture only)
+  long long live_window;     // Length of the sliding live window in ps (0 = off)
+  long long live_step;       // Update period of the live modes in ps
+  long long decay_half_life; // Half-life of the exponentially-decaying histogram in ps (0 = off)
+  const char *save_snapshot; // Write the per-channel histograms to this snapshot file
+  const char *merge_output;  // Sum all input snapshots into this snapshot file
+  int sweep_guard_bands;     // Run find_optimal_guard_bands after the analysis
+  const char *cache_dir;     // Analysis cache directory (NULL = no cache)
+  size_t cache_size_mb;      // Size limit of the analysis cache
+  const char *tail_state;    // State file of the incremental mode (NULL = off)
+  int follow;                // Keep running and update whenever the input grows
+  int batch;                 // Analyze every input file, one row per file
+  const char *batch_list;    // File listing more batch inputs, one per line ("-" = stdin)
+  int processes;             // Shard the input across this many worker processes (0 = off)
+  int numa;                  // Parallel ingest with threads and histograms bound per NUMA node
+  int benchmark_fill;        // Run the histogram-fill microbenchmark instead of an analysis
+  int check_binomial;        // Check the bootstrap's binomial sampler instead of an analysis
+  int resolution;            // ps per histogram bin of the analysis (divides 1000)
+  int subps;                 // Bins per ps for fractional timestamps (1 = whole picoseconds)
+  double confidence;         // Level of the printed confidence intervals (0 = none)
+  int bootstrap;             // Bootstrap resamples (0 = analytic intervals only)
+  uint64_t seed;             // Seed of the bootstrap RNG streams and of random block sampling
+  double target_precision;   // Stop reading sampled blocks once BER1/BER2 are known to +- this (0 = off)
+  int sample_order;          // SAMPLE_ORDER_STRIDED or SAMPLE_ORDER_RANDOM
+  int preview;               // Analyze a random sample of blocks and bound its error
+  int64_t preview_blocks;    // Blocks read by the preview
+  int build_index;           // Write the sidecar byte-offset index of the input and exit
+  int64_t index_lines;       // Lines per index entry
+  int time_range;            // Analyze only timestamps in [range_start, range_end), via the index
+  int64_t range_start, range_end;
+  int store;                 // Load the input into the columnar store and answer queries from stdin
+  const char *daemon_socket; // Serve analyses on this Unix socket
+  size_t daemon_memory_mb;   // Memory limit of the captures kept by the daemon
+  const char *connect_socket; // Ask the daemon on this Unix socket instead of analyzing locally
+  const char *channels;      // Channel list of --connect requests (NULL = all)
+  int coincidences;          // Count coincidences between channels coincidence_a and coincidence_b
+  int32_t coincidence_a, coincidence_b;
+  int64_t coincidence_window; // Largest |t_b - t_a| of a coincidence in ps
+  int64_t coincidence_bin;    // Delay histogram bin width in ps
+  const char *coincidence_output; // Delay histogram file (NULL = stdout)
+  int32_t herald;            // Herald channel of the heralded analysis (-1 = off)
+  int64_t herald_window;     // Largest |t_signal - t_herald| of a heralded event in ps
+  int g2;                    // Compute g2(tau) of channels g2_a and g2_b
+  int32_t g2_a, g2_b;
+  int64_t g2_min, g2_max;    // tau range in ps
+  int64_t g2_bin;            // tau bin width in ps
+  const char *g2_output;     // g2 table file (NULL = stdout)
+};
+
+void print_usage(const char *program)
+{
+  printf("Usage: %s [options] <filename>\n", program);
+  printf("       %s --merge-snapshots <output> <snapshot>...\n", program);
+  printf("       %s --batch [--batch-list <file>] <filename or glob>...\n", program);
+  printf("Options:\n");
+  printf("  --sort                 Sort the capture with the external-memory sorter before analysis\n");
+  printf("  --sort-memory <MB>     Memory budget of the sorter (default %d)\n", DEFAULT_SORT_MEMORY_MB);
+  printf("  --sort-output <file>   Also write the ingested stream as binary time tags\n");
+  printf("  --reorder <ps>         Restore time order of locally out-of-order input within <ps>\n");
+  printf("  --counter-bits <n>     Unwrap timestamps from an n-bit wrapping counter\n");
+  printf("  --overflow-channel <c> Channel whose records mark counter overflows\n");
+  printf("  --slice <ps>           Also print BER/visibility for every <ps> of timestamp time\n");
+  printf("  --live-window <ps>     Publish BER/visibility over the last <ps> of timestamp time\n");
+  printf("  --live-step <ps>       Update period of the live modes (default window / %d or one half-life)\n", DEFAULT_LIVE_STEPS);
+  printf("  --decay-half-life <ps> Publish BER/visibility from an exponentially-decaying histogram\n");
+  printf("  --save-snapshot <file> Save the per-channel histograms as a binary snapshot\n");
+  printf("  --merge-snapshots <f>  Sum the input snapshots into snapshot <f>\n");
+  printf("  --sweep-guard-bands    Also search the optimal guard band\n");
+  printf("  --cache                Reuse histograms cached in $XDG_CACHE_HOME/qber (or ~/.cache/qber)\n");
+  printf("  --cache-dir <dir>      Reuse histograms cached in <dir>\n");
+  printf("  --cache-size <MB>      Size limit of the cache (default %d)\n", DEFAULT_CACHE_SIZE_MB);
+  printf("  --state <file>         Incremental mode: only parse lines appended since the last run\n");
+  printf("  --follow               With --state, keep updating as the input grows\n");
+  printf("  --batch                Analyze many captures in parallel, one row per file\n");
+  printf("  --batch-list <file>    Read more batch inputs from <file> (one per line, - for stdin)\n");
+  printf("  --processes <n>        Shard the input across <n> worker processes\n");
+  printf("  --numa                 Parallel ingest with --threads bound per NUMA node\n");
+  printf("  --benchmark-fill       Compare the naive and privatized histogram fills (no input needed)\n");
+  printf("  --check-binomial       Check the bootstrap's binomial sampler against n*p and n*p*(1-p) (no input needed)\n");
+  printf("  --resolution <ps>      Analyze with <ps>-wide bins (a divisor of 1000, default 1)\n");
+  printf("  --subps <n>            Keep fractional timestamps and analyze with <n> bins per ps\n");
+  printf("  --confidence <level>   Print analytic confidence intervals (e.g. 0.95)\n");
+  printf("  --bootstrap <n>        Also print bootstrap intervals from <n> resamples (--seed <n>)\n");
+  printf("  --target-precision <w> Read sampled blocks only until BER1/BER2 are known to +-<w>\n");
+  printf("  --sample-order <o>     Block order of --target-precision: strided (default) or random\n");
+  printf("  --preview              Analyze a random sample of 16KB blocks with error bounds\n");
+  printf("  --preview-blocks <n>   Blocks read by --preview (default 256)\n");
+  printf("  --build-index          Write the sidecar byte-offset index <filename>.qidx and exit\n");
+  printf("  --index-lines <n>      Lines per index entry (default 16384)\n");
+  printf("  --time-range <a>:<b>   Analyze timestamps in [a, b) ps, reading only the indexed blocks\n");
+  printf("  --store                Load the input into memory once and answer queries read from stdin\n");
+  printf("  --daemon <socket>      Serve analyses of cached captures on a Unix socket\n");
+  printf("  --daemon-memory <MB>   Memory limit of the daemon's captures, least recently used evicted (default %d)\n",
+         DEFAULT_DAEMON_MEMORY_MB);
+  printf("  --connect <socket>     Ask the daemon on <socket> (with --time-range, --channels, --sweep-guard-bands)\n");
+  printf("  --channels <c,c,...>   Channels 0-62 analyzed by --connect and --herald (default all)\n");
+  printf("  --coincidences <a>,<b> Count coincidences of channels a and b and histogram their delays\n");
+  printf("  --coincidence-window <ps> Largest |t_b - t_a| of a coincidence (default 1000)\n");
+  printf("  --coincidence-bin <ps> Delay histogram bin width (default 10)\n");
+  printf("  --coincidence-output <file> Write the delay histogram to <file> instead of stdout\n");
+  printf("  --herald <channel>     Analyze only signal events with a herald on <channel> (signals: --channels)\n");
+  printf("  --herald-window <ps>   Largest |t_signal - t_herald| of a heralded event (default 1000)\n");
+  printf("  --g2 <a>,<b>           Compute the normalized g2(tau) of channels a and b, tau = t_b - t_a\n");
+  printf("                         (a and b must differ; autocorrelation is not supported)\n");
+  printf("  --g2-range <min>:<max> tau range in ps (default -10000:10000)\n");
+  printf("  --g2-bin <ps>          tau bin width (default 100, at most %d bins over the range)\n", MAX_G2_BINS);
+  printf("  --g2-output <file>     Write the g2 table to <file> instead of stdout\n");
+  printf("  --temp-dir <dir>       Directory for sorted runs (default $TMPDIR or /tmp)\n");
+  printf("  --threads <n>          Worker threads (default: one per CPU)\n");
+}
+
+// Function to parse the command line into options, exits with the usage text on error
+void parse_options(int argc, char *argv[], struct options *options)
+{
+  const char *temp_dir = getenv("TMPDIR");
+
+  options->filename = NULL;
+  options->inputs = malloc(argc * sizeof(const char *));
+  options->input_count = 0;
+  options->external_sort = 0;
+  options->sort_memory_mb = DEFAULT_SORT_MEMORY_MB;
+  options->threads = 0;
+  options->temp_dir = temp_dir ? temp_dir : "/tmp";
+  options->sort_output = NULL;
+  options->reorder_horizon = 0;
+  options->counter_bits = 0;
+  options->overflow_channel = -1;
+  options->slice_width = 0;
+  options->live_window = 0;
+  options->live_step = 0;
+  options->decay_half_life = 0;
+  options->save_snapshot = NULL;
+  options->merge_output = NULL;
+  options->sweep_guard_bands = 0;
+  options->cache_dir = NULL;
+  options->cache_size_mb = DEFAULT_CACHE_SIZE_MB;
+  options->tail_state = NULL;
+  options->follow = 0;
+  options->batch = 0;
+  options->batch_list = NULL;
+  options->processes = 0;
+  options->numa = 0;
+  options->benchmark_fill = 0;
+  options->check_binomial = 0;
+  options->resolution = 1;
+  options->subps = 1;
+  options->confidence = 0;
+  options->bootstrap = 0;
+  options->seed = 1;
+  options->target_precision = 0;
+  options->sample_order = SAMPLE_ORDER_STRIDED;
+  options->preview = 0;
+  options->preview_blocks = DEFAULT_PREVIEW_BLOCKS;
+  options->build_index = 0;
+  options->index_lines = DEFAULT_INDEX_LINES;
+  options->time_range = 0;
+  options->range_start = 0;
+  options->range_end = 0;
+  options->store = 0;
+  options->daemon_socket = NULL;
+  options->daemon_memory_mb = DEFAULT_DAEMON_MEMORY_MB;
+  options->connect_socket = NULL;
+  options->channels = NULL;
+  options->coincidences = 0;
+  options->coincidence_a = 0;
+  options->coincidence_b = 0;
+  options->coincidence_window = DEFAULT_COINCIDENCE_WINDOW;
+  options->coincidence_bin = DEFAULT_COINCIDENCE_BIN;
+  options->coincidence_output = NULL;
+  options->herald = -1;
+  options->herald_window = DEFAULT_COINCIDENCE_WINDOW;
+  options->g2 = 0;
+  options->g2_a = 0;
+  options->g2_b = 0;
+  options->g2_min = -DEFAULT_G2_RANGE;
+  options->g2_max = DEFAULT_G2_RANGE;
+  options->g2_bin = DEFAULT_G2_BIN;
+  options->g2_output = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--sort") == 0)
+    {
+      options->external_sort = 1;
+      continue;
+    }
+    if (strcmp(arg, "--sweep-guard-bands") == 0)
+    {
+      options->sweep_guard_bands = 1;
+      continue;
+    }
+    if (strcmp(arg, "--batch") == 0)
+    {
+      options->batch = 1;
+      continue;
+    }
+    if (strcmp(arg, "--benchmark-fill") == 0)
+    {
+      options->benchmark_fill = 1;
+      continue;
+    }
+    if (strcmp(arg, "--check-binomial") == 0)
+    {
+      options->check_binomial = 1;
+      continue;
+    }
+    if (strcmp(arg, "--numa") == 0)
+    {
+      options->numa = 1;
+      continue;
+    }
+    if (strcmp(arg, "--preview") == 0)
+    {
+      options->preview = 1;
+      continue;
+    }
+    if (strcmp(arg, "--build-index") == 0)
+    {
+      options->build_index = 1;
+      continue;
+    }
+    if (strcmp(arg, "--store") == 0)
+    {
+      options->store = 1;
+      continue;
+    }
+    if (strcmp(arg, "--follow") == 0)
+    {
+      options->follow = 1;
+      continue;
+    }
+    if (strcmp(arg, "--cache") == 0)
+    {
+      static char default_cache_dir[4096];
+      const char *base = getenv("XDG_CACHE_HOME");
+      const char *home = getenv("HOME");
+      if (base)
+      {
+        snprintf(default_cache_dir, sizeof(default_cache_dir), "%s/qber", base);
+      }
+      else
+      {
+        snprintf(default_cache_dir, sizeof(default_cache_dir), "%s/.cache/qber", home ? home : "/tmp");
+      }
+      options->cache_dir = default_cache_dir;
+      continue;
+    }
+    if (arg[0] != '-' || arg[1] == '\0')
+    {
+      options->inputs[options->input_count++] = arg;
+      continue;
+    }
+    if (!value)
+    {
+      printf("Error: Option %s needs a value\n", arg);
+      exit(1);
+    }
+    i++;
+
+    if (strcmp(arg, "--sort-memory") == 0)
+    {
+      options->sort_memory_mb = strtoull(value, NULL, 10);
+      if (options->sort_memory_mb < MIN_SORT_MEMORY_MB)
+      {
+        printf("Error: --sort-memory must be at least %d MB\n", MIN_SORT_MEMORY_MB);
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--sort-output") == 0)
+    {
+      options->sort_output = value;
+    }
+    else if (strcmp(arg, "--reorder") == 0)
+    {
+      options->reorder_horizon = atoll(value);
+    }
+    else if (strcmp(arg, "--counter-bits") == 0)
+    {
+      options->counter_bits = atoi(value);
+      if (options->counter_bits < 1 || options->counter_bits > 62)
+      {
+        printf("Error: --counter-bits must be between 1 and 62\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--overflow-channel") == 0)
+    {
+      options->overflow_channel = atoi(value);
+    }
+    else if (strcmp(arg, "--slice") == 0)
+    {
+      options->slice_width = atoll(value);
+    }
+    else if (strcmp(arg, "--live-window") == 0)
+    {
+      options->live_window = atoll(value);
+    }
+    else if (strcmp(arg, "--live-step") == 0)
+    {
+      options->live_step = atoll(value);
+    }
+    else if (strcmp(arg, "--decay-half-life") == 0)
+    {
+      options->decay_half_life = atoll(value);
+    }
+    else if (strcmp(arg, "--save-snapshot") == 0)
+    {
+      options->save_snapshot = value;
+    }
+    else if (strcmp(arg, "--merge-snapshots") == 0)
+    {
+      options->merge_output = value;
+    }
+    else if (strcmp(arg, "--cache-dir") == 0)
+    {
+      options->cache_dir = value;
+    }
+    else if (strcmp(arg, "--cache-size") == 0)
+    {
+      options->cache_size_mb = strtoull(value, NULL, 10);
+    }
+    else if (strcmp(arg, "--batch-list") == 0)
+    {
+      options->batch = 1;
+      options->batch_list = value;
+    }
+    else if (strcmp(arg, "--processes") == 0)
+    {
+      options->processes = atoi(value);
+    }
+    else if (strcmp(arg, "--resolution") == 0)
+    {
+      options->resolution = atoi(value);
+      if (options->resolution < 1 || 1000 % options->resolution != 0)
+      {
+        printf("Error: --resolution must divide 1000 ps\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--subps") == 0)
+    {
+      options->subps = atoi(value);
+      if (options->subps < 1 || options->subps > MAX_SUBPS)
+      {
+        printf("Error: --subps must be between 1 and %d\n", MAX_SUBPS);
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--confidence") == 0)
+    {
+      options->confidence = atof(value);
+      if (options->confidence <= 0 || options->confidence >= 1)
+      {
+        printf("Error: --confidence must be between 0 and 1\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--bootstrap") == 0)
+    {
+      options->bootstrap = atoi(value);
+    }
+    else if (strcmp(arg, "--seed") == 0)
+    {
+      options->seed = strtoull(value, NULL, 10);
+    }
+    else if (strcmp(arg, "--target-precision") == 0)
+    {
+      options->target_precision = atof(value);
+      if (options->target_precision <= 0)
+      {
+        printf("Error: --target-precision must be positive\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--coincidences") == 0)
+    {
+      options->coincidences = 1;
+      if (sscanf(value, "%d,%d", &options->coincidence_a, &options->coincidence_b) != 2 ||
+          options->coincidence_a == options->coincidence_b)
+      {
+        printf("Error: --coincidences must be two different channels <a>,<b>\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--coincidence-window") == 0)
+    {
+      options->coincidence_window = atoll(value);
+    }
+    else if (strcmp(arg, "--coincidence-bin") == 0)
+    {
+      options->coincidence_bin = atoll(value);
+    }
+    else if (strcmp(arg, "--coincidence-output") == 0)
+    {
+      options->coincidence_output = value;
+    }
+    else if (strcmp(arg, "--g2") == 0)
+    {
+      options->g2 = 1;
+      if (sscanf(value, "%d,%d", &options->g2_a, &options->g2_b) != 2 || options->g2_a == options->g2_b ||
+          options->g2_a < 0 || options->g2_b < 0)
+      {
+        printf("Error: --g2 must be two different channels <a>,<b> (autocorrelation is not supported)\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--g2-range") == 0)
+    {
+      char *separator;
+      options->g2_min = strtoll(value, &separator, 10);
+      if (*separator != ':' || (options->g2_max = strtoll(separator + 1, NULL, 10)) <= options->g2_min)
+      {
+        printf("Error: --g2-range must be <min>:<max> with min < max\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--g2-bin") == 0)
+    {
+      options->g2_bin = atoll(value);
+      if (options->g2_bin <= 0)
+      {
+        printf("Error: --g2-bin must be positive\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--g2-output") == 0)
+    {
+      options->g2_output = value;
+    }
+    else if (strcmp(arg, "--herald") == 0)
+    {
+      options->herald = atoi(value);
+      if (options->herald < 0)
+      {
+        printf("Error: --herald must be a channel number\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--herald-window") == 0)
+    {
+      options->herald_window = atoll(value);
+      if (options->herald_window <= 0)
+      {
+        printf("Error: --herald-window must be positive\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--daemon") == 0)
+    {
+      options->daemon_socket = value;
+    }
+    else if (strcmp(arg, "--daemon-memory") == 0)
+    {
+      options->daemon_memory_mb = strtoull(value, NULL, 10);
+    }
+    else if (strcmp(arg, "--connect") == 0)
+    {
+      options->connect_socket = value;
+    }
+    else if (strcmp(arg, "--channels") == 0)
+    {
+      options->channels = value;
+    }
+    else if (strcmp(arg, "--index-lines") == 0)
+    {
+      options->index_lines = atoll(value);
+      if (options->index_lines < 1)
+      {
+        printf("Error: --index-lines must be positive\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--time-range") == 0)
+    {
+      char *separator;
+      options->time_range = 1;
+      options->range_start = strtoll(value, &separator, 10);
+      if (*separator != ':' || (options->range_end = strtoll(separator + 1, NULL, 10)) <= options->range_start)
+      {
+        printf("Error: --time-range must be <start>:<end> with start < end\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--preview-blocks") == 0)
+    {
+      options->preview_blocks = atoll(value);
+      if (options->preview_blocks < 2)
+      {
+        printf("Error: --preview-blocks must be at least 2\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--sample-order") == 0)
+    {
+      if (strcmp(value, "strided") == 0)
+      {
+        options->sample_order = SAMPLE_ORDER_STRIDED;
+      }
+      else if (strcmp(value, "random") == 0)
+      {
+        options->sample_order = SAMPLE_ORDER_RANDOM;
+      }
+      else
+      {
+        printf("Error: --sample-order must be strided or random\n");
+        exit(1);
+      }
+    }
+    else if (strcmp(arg, "--state") == 0)
+    {
+      options->tail_state = value;
+    }
+    else if (strcmp(arg, "--temp-dir") == 0)
+    {
+      options->temp_dir = value;
+    }
+    else if (strcmp(arg, "--threads") == 0)
+    {
+      options->threads = atoi(value);
+    }
+    else
+    {
+      printf("Error: Unknown option %s\n", arg);
+      print_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if ((options->input_count == 0 && !options->batch_list && !options->benchmark_fill && !options->check_binomial &&
+       !options->daemon_socket) ||
+      (options->input_count > 1 && !options->merge_output && !options->batch))
+  {
+    print_usage(argv[0]);
+    exit(1);
+  }
+  options->filename = options->inputs[0];
+  if ((options->processes > 1 || options->numa || options->target_precision > 0 || options->preview ||
+       options->time_range || options->store) &&
+      (options->external_sort || options->sort_output || options->reorder_horizon > 0 || options->counter_bits > 0 ||
+       options->slice_width > 0 || options->live_window > 0 || options->decay_half_life > 0 || options->save_snapshot ||
+       options->merge_output || options->cache_dir || options->tail_state || options->batch))
+  {
+    printf("Error: --processes, --numa, --target-precision, --preview, --time-range and --store cannot be combined "
+           "with ordered ingest, snapshot, cache, state or batch options\n");
+    exit(1);
+  }
+  if (options->batch &&
+      (options->external_sort || options->sort_output || options->reorder_horizon > 0 || options->slice_width > 0 ||
+       options->live_window > 0 || options->decay_half_life > 0 || options->save_snapshot || options->merge_output ||
+       options->cache_dir || options->tail_state || options->sweep_guard_bands || options->confidence > 0 ||
+       options->bootstrap > 0))
+  {
+    printf("Error: --batch cannot be combined with sort, reorder, slice, live, snapshot, merge, cache, state, "
+           "guard-band sweep or confidence options\n");
+    exit(1);
+  }
+  if (options->tail_state &&
+      (options->external_sort || options->sort_output || options->reorder_horizon > 0 || options->slice_width > 0 ||
+       options->live_window > 0 || options->decay_half_life > 0 || options->save_snapshot || options->merge_output ||
+       options->cache_dir || options->sweep_guard_bands || options->confidence > 0 || options->bootstrap > 0))
+  {
+    printf("Error: --state cannot be combined with sort, reorder, slice, live, snapshot, merge, cache, "
+           "guard-band sweep or confidence options\n");
+    exit(1);
+  }
+  // The daemon answers from a plain store_load and a request carries only the range, channels and sweep
+  if ((options->daemon_socket || options->connect_socket) &&
+      ((options->daemon_socket && options->connect_socket) || options->external_sort || options->sort_output ||
+       options->reorder_horizon > 0 || options->counter_bits > 0 || options->resolution > 1 || options->subps > 1 ||
+       options->confidence > 0 || options->bootstrap > 0 || options->herald >= 0 || options->g2 ||
+       options->coincidences || options->slice_width > 0 || options->live_window > 0 ||
+       options->decay_half_life > 0 || options->save_snapshot || options->merge_output || options->cache_dir ||
+       options->tail_state || options->batch || options->processes > 1 || options->numa ||
+       options->target_precision > 0 || options->preview || options->store || options->build_index))
+  {
+    printf("Error: --daemon and --connect cannot be combined with each other or with sort, reorder, counter, "
+           "resolution, sub-ps, confidence, herald, g2, coincidence, slice, live, snapshot, cache, state, batch, "
+           "sampling, store, index or parallel options\n");
+    exit(1);
+  }
+  if (options->daemon_socket && (options->time_range || options->channels || options->sweep_guard_bands))
+  {
+    printf("Error: --time-range, --channels and --sweep-guard-bands are sent with --connect, not given to --daemon\n");
+    exit(1);
+  }
+  if (options->preview && (options->target_precision > 0 || options->resolution > 1))
+  {
+    printf("Error: --preview cannot be combined with --target-precision or --resolution\n");
+    exit(1);
+  }
+  if (options->time_range && (options->target_precision > 0 || options->preview))
+  {
+    printf("Error: --time-range cannot be combined with --target-precision or --preview\n");
+    exit(1);
+  }
+  if (options->resolution > 1 && (options->tail_state || options->batch || options->store))
+  {
+    printf("Error: --resolution cannot be combined with --state, --batch or --store\n");
+    exit(1);
+  }
+  if (options->subps > 1 && (options->resolution > 1 || options->save_snapshot || options->merge_output ||
+                              options->cache_dir || options->numa || options->processes > 1 || options->tail_state ||
+                              options->batch || options->target_precision > 0 || options->preview ||
+                              options->time_range || options->store))
+  {
+    printf("Error: --subps cannot be combined with --resolution, snapshot, cache, state, batch or parallel options\n");
+    exit(1);
+  }
+  if (options->coincidences &&
+      (options->coincidence_window <= 0 || options->coincidence_bin <= 0 || options->slice_width > 0 ||
+       options->live_window > 0 || options->decay_half_life > 0 || options->save_snapshot || options->merge_output ||
+       options->cache_dir || options->tail_state || options->batch || options->processes > 1 || options->numa ||
+       options->target_precision > 0 || options->preview || options->time_range || options->store))
+  {
+    printf("Error: --coincidences needs a positive window and bin and cannot be combined with slice, live, "
+           "snapshot, cache, state, batch, sampling, range, store or parallel options\n");
+    exit(1);
+  }
+  if (options->coincidences)
+  {
+    // Unsigned, as 2 * window overflows int64_t for windows above 2^62
+    uint64_t span = 2 * (uint64_t)options->coincidence_window;
+    uint64_t bins = span / options->coincidence_bin + 1;
+    if (options->coincidence_window > INT64_MAX / 2 || bins > MAX_COINCIDENCE_BINS)
+    {
+      printf("Error: --coincidence-window and --coincidence-bin must give at most %d delay bins\n",
+             MAX_COINCIDENCE_BINS);
+      exit(1);
+    }
+  }
+  if (options->herald >= 0 &&
+      (options->slice_width > 0 || options->live_window > 0 || options->decay_half_life > 0 || options->save_snapshot ||
+       options->merge_output || options->cache_dir || options->tail_state || options->batch || options->processes > 1 ||
+       options->numa || options->target_precision > 0 || options->preview || options->time_range || options->store ||
+       options->coincidences || options->subps > 1))
+  {
+    printf("Error: --herald cannot be combined with slice, live, snapshot, cache, state, batch, sampling, range, "
+           "store, coincidence, sub-ps or parallel options\n");
+    exit(1);
+  }
+  if (options->g2 &&
+      (options->slice_width > 0 || options->live_window > 0 || options->decay_half_life > 0 || options->save_snapshot ||
+       options->merge_output || options->cache_dir || options->tail_state || options->batch || options->processes > 1 ||
+       options->numa || options->target_precision > 0 || options->preview || options->time_range || options->store ||
+       options->coincidences || options->herald >= 0))
+  {
+    printf("Error: --g2 cannot be combined with slice, live, snapshot, cache, state, batch, sampling, range, store, "
+           "coincidence, herald or parallel options\n");
+    exit(1);
+  }
+  if (options->g2)
+  {
+    // Unsigned, as the span of a range such as -2^62:2^62 does not fit in int64_t
+    uint64_t span = (uint64_t)options->g2_max - (uint64_t)options->g2_min;
+    uint64_t bins = span / options->g2_bin + (span % options->g2_bin != 0);
+    if (span > INT64_MAX || bins > MAX_G2_BINS)
+    {
+      printf("Error: --g2-range and --g2-bin must give at most %d bins over a range shorter than 2^63 ps\n",
+             MAX_G2_BINS);
+      exit(1);
+    }
+  }
+  if (options->follow && !options->tail_state)
+  {
+    printf("Error: --follow needs --state <file>\n");
+    exit(1);
+  }
+  if (options->bootstrap > 0 && options->confidence == 0)
+  {
+    options->confidence = DEFAULT_CONFIDENCE;
+  }
+  if (options->live_window > 0 && options->live_step <= 0)
+  {
+    options->live_step = (options->live_window + DEFAULT_LIVE_STEPS - 1) / DEFAULT_LIVE_STEPS;
+  }
+  if (options->threads <= 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options->threads = cpus > 0 ? (int)cpus : 1;
+  }
+}
+
+/*
+  Analysis cache
+
+  Ingesting a capture is by far the most expensive step, and the histogram does not depend on the window
+  or guard-band parameters. The cache stores, per input, the snapshot of its per-channel histograms
+  followed by the prefix-sum table of the combined histogram, so a repeated analysis skips ingestion.
+  Entries are named after a key that hashes the content fingerprint (size and sampled blocks), the
+  modification time and the ingest options that change the histogram; a modified file therefore never
+  matches its old entry. A hit is re-validated against the stored fingerprint and size, and any entry
+  that fails to read is deleted and treated as a miss. Entries are written to a temporary file and renamed
+  into place, so concurrent runs never see a partial entry. A hit refreshes the entry's mtime, and after
+  every insert the least recently used entries are removed until the cache fits in its size limit.
+*/
+
+#define CACHE_ENTRY_SUFFIX ".qcache"
+
+struct cache_entry_info
+{
+  char name[64];
+  off_t size;
+  time_t last_used;
+};
+
+// Function to compute the cache key of an input file under the given ingest options
+uint64_t cache_key(const char *filename, uint64_t fingerprint, const struct options *options)
+{
+  struct stat info;
+  if (stat(filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+
+  int64_t fields[6] = {(int64_t)info.st_mtim.tv_sec, (int64_t)info.st_mtim.tv_nsec, options->counter_bits,
+                       options->overflow_channel, WINDOW_SIZE / options->resolution, options->resolution};
+  return fnv1a_64(fingerprint, fields, sizeof(fields));
+}
+
+void cache_entry_path(const struct options *options, uint64_t key, char *path, size_t size)
+{
+  snprintf(path, size, "%s/%016llx%s", options->cache_dir, (unsigned long long)key, CACHE_ENTRY_SUFFIX);
+}
+
+// Function to load a cache entry; returns 1 on a valid hit, 0 (after removing a bad entry) otherwise
+int cache_lookup(const struct options *options, uint64_t key, uint64_t fingerprint, struct histogram_snapshot *snapshot, int64_t *prefix)
+{
+  char path[4096];
+  cache_entry_path(options, key, path, sizeof(path));
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    return 0;
+  }
+
+  int period = WINDOW_SIZE / options->resolution;
+  int valid = snapshot_read(snapshot, file) == 0 && snapshot->header.fingerprint == fingerprint &&
+              snapshot->header.period == period && snapshot->header.resolution == options->resolution &&
+              fread(prefix, sizeof(int64_t), period + 1, file) == (size_t)period + 1;
+  fclose(file);
+
+  if (!valid)
+  {
+    snapshot_free(snapshot);
+    unlink(path);
+    return 0;
+  }
+
+  // Mark the entry as recently used
+  utimensat(AT_FDCWD, path, NULL, 0);
+  return 1;
+}
+
+int compare_cache_entries(const void *a, const void *b)
+{
+  const struct cache_entry_info *x = a, *y = b;
+  return (x->last_used > y->last_used) - (x->last_used < y->last_used);
+}
+
+// Function to delete least recently used entries until the cache fits in its size limit
+void cache_evict(const struct options *options)
+{
+  DIR *directory = opendir(options->cache_dir);
+  if (!directory)
+  {
+    return;
+  }
+
+  struct cache_entry_info *entries = NULL;
+  int count = 0, capacity = 0;
+  off_t total = 0;
+  struct dirent *item;
+  size_t suffix_length = strlen(CACHE_ENTRY_SUFFIX);
+
+  while ((item = readdir(directory)) != NULL)
+  {
+    size_t length = strlen(item->d_name);
+    if (length <= suffix_length || length >= sizeof(entries->name) ||
+        strcmp(item->d_name + length - suffix_length, CACHE_ENTRY_SUFFIX) != 0)
+    {
+      continue;
+    }
+
+    struct stat info;
+    if (fstatat(dirfd(directory), item->d_name, &info, 0) != 0)
+    {
+      continue;
+    }
+    if (count == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 64;
+      entries = realloc(entries, capacity * sizeof(struct cache_entry_info));
+      if (!entries)
+      {
+        printf("Error: Out of memory\n");
+        exit(1);
+      }
+    }
+    strcpy(entries[count].name, item->d_name);
+    entries[count].size = info.st_size;
+    entries[count].last_used = info.st_mtime;
+    total += info.st_size;
+    count++;
+  }
+
+  qsort(entries, count, sizeof(struct cache_entry_info), compare_cache_entries);
+  off_t limit = (off_t)options->cache_size_mb << 20;
+  for (int i = 0; i < count && total > limit; i++)
+  {
+    if (unlinkat(dirfd(directory), entries[i].name, 0) == 0)
+    {
+      total -= entries[i].size;
+    }
+  }
+
+  free(entries);
+  closedir(directory);
+}
+
+// Function to store a snapshot and its prefix-sum table under the key
+void cache_store(const struct options *options, uint64_t key, const struct histogram_snapshot *snapshot, const int64_t *prefix)
+{
+  char path[4096], temporary[4200];
+
+  mkdir(options->cache_dir, 0755);
+  cache_entry_path(options, key, path, sizeof(path));
+  snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    return; // The cache is an optimization: an unwritable cache directory is not an error
+  }
+  snapshot_write(snapshot, fd);
+  write_all(fd, prefix, (snapshot->header.period + 1) * sizeof(int64_t));
+  close(fd);
+
+  if (rename(temporary, path) != 0)
+  {
+    unlink(temporary);
+    return;
+  }
+  cache_evict(options);
+}
+
+// Function to report whether a run only needs the final histogram, so a cached one can replace ingestion
+int cache_usable(const struct options *options)
+{
+  return options->cache_dir && !options->slice_width && !options->live_window && !options->decay_half_life &&
+         !options->sort_output;
+}
+
+// Streaming ingest pipeline:
+// CSV reader -> optional rollover unwrapping -> optional external sort or reorder buffer
+// -> optional time slicing -> optional sliding window -> optional decaying histogram -> optional tee
+struct ingest
+{
+  struct csv_reader reader;
+  struct rollover_unwrapper unwrapper;
+  struct merge_stream sorted;
+  struct reorder_buffer reorder;
+  struct slice_series slices;
+  struct sliding_histogram sliding;
+  struct decaying_histogram decaying;
+  struct tag_tee tee;
+  struct tag_source stages[8];
+  struct tag_source *source; // Last stage, consumed by the analysis
+  const struct options *options;
+};
+
+// Function to report whether the options need the streaming ingest pipeline
+int ingest_needed(const struct options *options)
+{
+  return options->external_sort || options->reorder_horizon > 0 || options->counter_bits > 0 ||
+         options->slice_width > 0 || options->live_window > 0 || options->decay_half_life > 0 ||
+         options->save_snapshot || options->subps > 1 || cache_usable(options);
+}
+
+// Function to assemble the ingest stages selected by the options
+void ingest_open(struct ingest *ingest, const struct options *options)
+{
+  int stage = 0;
+  ingest->options = options;
+
+  csv_reader_open(&ingest->reader, options->filename);
+  ingest->stages[stage++] = (struct tag_source){csv_reader_read, &ingest->reader};
+
+  if (options->counter_bits > 0)
+  {
+    rollover_unwrapper_init(&ingest->unwrapper, &ingest->stages[stage - 1], options->counter_bits, options->overflow_channel);
+    ingest->stages[stage++] = (struct tag_source){rollover_unwrapper_read, &ingest->unwrapper};
+  }
+
+  if (options->external_sort)
+  {
+    struct external_sort_config config;
+    config.memory_budget = options->sort_memory_mb << 20;
+    config.threads = options->threads;
+    config.temp_dir = options->temp_dir;
+    external_sort_open(&ingest->stages[stage - 1], &config, &ingest->sorted);
+    ingest->stages[stage++] = (struct tag_source){merge_stream_read, &ingest->sorted};
+  }
+
+  if (options->reorder_horizon > 0)
+  {
+    reorder_buffer_init(&ingest->reorder, &ingest->stages[stage - 1], options->reorder_horizon);
+    ingest->stages[stage++] = (struct tag_source){reorder_buffer_read, &ingest->reorder};
+  }
+
+  if (options->slice_width > 0)
+  {
+    slice_series_init(&ingest->slices, &ingest->stages[stage - 1], options->slice_width);
+    ingest->stages[stage++] = (struct tag_source){slice_series_read, &ingest->slices};
+  }
+
+  if (options->live_window > 0)
+  {
+    sliding_histogram_init(&ingest->sliding, &ingest->stages[stage - 1], options->live_window, options->live_step);
+    ingest->stages[stage++] = (struct tag_source){sliding_histogram_read, &ingest->sliding};
+  }
+
+  if (options->decay_half_life > 0)
+  {
+    decaying_histogram_init(&ingest->decaying, &ingest->stages[stage - 1], options->decay_half_life,
+                            options->live_step > 0 ? options->live_step : options->decay_half_life);
+    ingest->stages[stage++] = (struct tag_source){decaying_histogram_read, &ingest->decaying};
+  }
+
+  // Optionally copy the stream to disk while it feeds the analysis
+  ingest->tee.fd = -1;
+  if (options->sort_output)
+  {
+    ingest->tee.upstream = &ingest->stages[stage - 1];
+    ingest->tee.fd = open(options->sort_output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ingest->tee.fd < 0)
+    {
+      printf("Error: Could not create file %s\n", options->sort_output);
+      exit(1);
+    }
+    ingest->stages[stage++] = (struct tag_source){tag_tee_read, &ingest->tee};
+  }
+
+  ingest->source = &ingest->stages[stage - 1];
+}
+
+// Function to tear down the pipeline and print the statistics of its stages
+void ingest_close(struct ingest *ingest)
+{
+  const struct options *options = ingest->options;
+
+  if (ingest->tee.fd >= 0)
+  {
+    close(ingest->tee.fd);
+  }
+  if (options->decay_half_life > 0)
+  {
+    struct decaying_histogram *decaying = &ingest->decaying;
+    printf("Decaying histogram: %llu updates with a %lld ps half-life, %.2f us per update, %llu renormalizations\n",
+           (unsigned long long)decaying->publishes, (long long)decaying->half_life,
+           decaying->publishes ? 1e6 * decaying->publish_seconds / decaying->publishes : 0.0,
+           (unsigned long long)decaying->renormalizations);
+    free(decaying->bins);
+    free(decaying->counts);
+  }
+  if (options->live_window > 0)
+  {
+    struct sliding_histogram *sliding = &ingest->sliding;
+    printf("Sliding window: %llu updates of a %lld ps window, %.2f us per update, %llu late events\n",
+           (unsigned long long)sliding->publishes, (long long)(sliding->steps * sliding->step),
+           sliding->publishes ? 1e6 * sliding->publish_seconds / sliding->publishes : 0.0,
+           (unsigned long long)sliding->late_events);
+    sliding_histogram_free(sliding);
+  }
+  if (options->slice_width > 0)
+  {
+    printf("Time slices: %llu slices of %lld ps, %llu events arrived after their slice was closed\n",
+           (unsigned long long)ingest->slices.slices, (long long)options->slice_width,
+           (unsigned long long)ingest->slices.late_events);
+    slice_series_free(&ingest->slices);
+  }
+  if (options->reorder_horizon > 0)
+  {
+    printf("Reorder buffer: max disorder %lld ps, %llu of %llu events later than the %lld ps horizon\n",
+           (long long)ingest->reorder.max_disorder, (unsigned long long)ingest->reorder.late_events,
+           (unsigned long long)ingest->reorder.events, (long long)ingest->reorder.horizon);
+    reorder_buffer_free(&ingest->reorder);
+  }
+  if (options->counter_bits > 0)
+  {
+    printf("Rollover unwrapping: %llu wraps of the %d-bit counter, %llu overflow records\n",
+           (unsigned long long)ingest->unwrapper.wraps, options->counter_bits,
+           (unsigned long long)ingest->unwrapper.overflow_records);
+  }
+  if (options->external_sort)
+  {
+    merge_stream_close(&ingest->sorted);
+  }
+  csv_reader_close(&ingest->reader);
+}
+
+/*
+  Incremental tail-append processing
+
+  Acquisition software appends to the CSV while the experiment runs. With --state, the per-channel
+  histograms are kept in a state file (a snapshot followed by struct tail_state) together with the byte
+  offset of the first unprocessed line. Each invocation parses only the complete lines appended since
+  then, so the cost of an update is proportional to the new data. A line still being written (no '\n'
+  yet) is left for the next update. If the file shrank or its first bytes changed, it was replaced and
+  processing starts over. With --follow the program keeps running and updates on every inotify
+  notification for the file.
+*/
+
+#define TAIL_STATE_MAGIC "QBERTAIL" // 8 bytes, no terminator stored
+#define TAIL_HEAD_BYTES 4096        // Bytes at the start of the input hashed to detect a replaced file
+
+struct tail_state
+{
+  char magic[8];
+  int64_t offset;           // First byte not processed yet (always the start of a line)
+  uint64_t head_hash;       // Hash of the first min(offset, TAIL_HEAD_BYTES) bytes of the input
+  int32_t counter_bits;     // Unwrapping options the state was built with
+  int32_t overflow_channel;
+  // Rollover unwrapper state carried across updates
+  int64_t unwrap_offset;
+  int64_t unwrap_previous;
+  int64_t unwrap_started;
+  uint64_t unwrap_wraps;
+  uint64_t unwrap_overflow_records;
+};
+
+// Function to hash the first length bytes (at most TAIL_HEAD_BYTES) of a file
+uint64_t file_head_hash(const char *filename, int64_t length)
+{
+  char head[TAIL_HEAD_BYTES];
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  ssize_t bytes = pread(fd, head, length < TAIL_HEAD_BYTES ? length : TAIL_HEAD_BYTES, 0);
+  close(fd);
+  return fnv1a_64(14695981039346656037ULL, head, bytes > 0 ? bytes : 0);
+}
+
+// Function to start from an empty histogram at the beginning of the input
+void tail_state_reset(const struct options *options, struct histogram_snapshot *snapshot, struct tail_state *state)
+{
+  snapshot_init(snapshot, WINDOW_SIZE, 1);
+  memset(state, 0, sizeof(*state));
+  memcpy(state->magic, TAIL_STATE_MAGIC, 8);
+  state->counter_bits = options->counter_bits;
+  state->overflow_channel = options->overflow_channel;
+}
+
+// Function to load the state file; starts over if it is missing, unreadable or built with other options
+void tail_state_load(const struct options *options, struct histogram_snapshot *snapshot, struct tail_state *state)
+{
+  FILE *file = fopen(options->tail_state, "rb");
+  if (file)
+  {
+    int valid = snapshot_read(snapshot, file) == 0 && fread(state, sizeof(*state), 1, file) == 1 &&
+                memcmp(state->magic, TAIL_STATE_MAGIC, 8) == 0 && snapshot->header.period == WINDOW_SIZE &&
+                state->counter_bits == options->counter_bits && state->overflow_channel == options->overflow_channel;
+    fclose(file);
+    if (valid)
+    {
+      return;
+    }
+    snapshot_free(snapshot);
+  }
+  tail_state_reset(options, snapshot, state);
+}
+
+// Function to replace the state file atomically
+void tail_state_save(const struct options *options, const struct histogram_snapshot *snapshot, const struct tail_state *state)
+{
+  char temporary[4200];
+  snprintf(temporary, sizeof(temporary), "%s.%d.tmp", options->tail_state, (int)getpid());
+
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    printf("Error: Could not create file %s\n", temporary);
+    exit(1);
+  }
+  snapshot_write(snapshot, fd);
+  write_all(fd, state, sizeof(*state));
+  close(fd);
+  if (rename(temporary, options->tail_state) != 0)
+  {
+    printf("Error: Could not replace %s\n", options->tail_state);
+    exit(1);
+  }
+}
+
+// Function to fold the lines appended since the last update into the state. Returns 1 if anything was read.
+int tail_update(const struct options *options, struct histogram_snapshot *snapshot, struct tail_state *state)
+{
+  struct stat info;
+  if (stat(options->filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", options->filename);
+    exit(1);
+  }
+
+  if (info.st_size < state->offset ||
+      (state->offset > 0 && file_head_hash(options->filename, state->offset) != state->head_hash))
+  {
+    printf("Note: %s was truncated or replaced, starting over\n", options->filename);
+    snapshot_free(snapshot);
+    tail_state_reset(options, snapshot, state);
+  }
+  if (info.st_size == state->offset)
+  {
+    return 0;
+  }
+
+  struct csv_reader reader;
+  struct rollover_unwrapper unwrapper;
+  csv_reader_open_at(&reader, options->filename, state->offset, 1);
+  struct tag_source csv_source = {csv_reader_read, &reader};
+  struct tag_source unwrap_source = {rollover_unwrapper_read, &unwrapper};
+
+  if (options->counter_bits > 0)
+  {
+    rollover_unwrapper_init(&unwrapper, &csv_source, options->counter_bits, options->overflow_channel);
+    unwrapper.offset = state->unwrap_offset;
+    unwrapper.previous = state->unwrap_previous;
+    unwrapper.started = (int)state->unwrap_started;
+    unwrapper.wraps = state->unwrap_wraps;
+    unwrapper.overflow_records = state->unwrap_overflow_records;
+  }
+
+  fill_snapshot_from_source(options->counter_bits > 0 ? &unwrap_source : &csv_source, snapshot);
+
+  int64_t previous_offset = state->offset;
+  state->offset = csv_reader_offset(&reader);
+  state->head_hash = file_head_hash(options->filename, state->offset);
+  if (options->counter_bits > 0)
+  {
+    state->unwrap_offset = unwrapper.offset;
+    state->unwrap_previous = unwrapper.previous;
+    state->unwrap_started = unwrapper.started;
+    state->unwrap_wraps = unwrapper.wraps;
+    state->unwrap_overflow_records = unwrapper.overflow_records;
+  }
+  csv_reader_close(&reader);
+  return state->offset != previous_offset;
+}
+
+// Function to block until the input file changes
+void wait_for_file_change(const char *filename, int *notify_fd, int *watch)
+{
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  for (;;)
+  {
+    if (*watch < 0)
+    {
+      *watch = inotify_add_watch(*notify_fd, filename, IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+      if (*watch < 0)
+      {
+        sleep(1); // The file is being replaced; try again
+        continue;
+      }
+    }
+
+    ssize_t bytes = read(*notify_fd, events, sizeof(events));
+    if (bytes <= 0)
+    {
+      printf("Error: Could not watch %s\n", filename);
+      exit(1);
+    }
+    for (char *p = events; p < events + bytes; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+    {
+      uint32_t mask = ((struct inotify_event *)p)->mask;
+      if (mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+      {
+        inotify_rm_watch(*notify_fd, *watch);
+        *watch = -1;
+      }
+    }
+    return;
+  }
+}
+
+// Function to run the incremental mode: update from the saved offset, print the results, and with --follow repeat on every change
+void run_incremental(const struct options *options)
+{
+  struct histogram_snapshot snapshot;
+  struct tail_state state;
+  int histogram[WINDOW_SIZE];
+  int notify_fd = -1, watch = -1;
+
+  tail_state_load(options, &snapshot, &state);
+  if (options->follow)
+  {
+    notify_fd = inotify_init1(IN_CLOEXEC);
+    if (notify_fd < 0)
+    {
+      printf("Error: inotify is not available\n");
+      exit(1);
+    }
+  }
+
+  for (int first = 1;; first = 0)
+  {
+    if (tail_update(options, &snapshot, &state) || first)
+    {
+      double BER1, V1, BER2, V2;
+      tail_state_save(options, &snapshot, &state);
+      snapshot_combined_histogram(&snapshot, histogram);
+      int start_index = find_max_sum_window(histogram, WINDOW_SIZE, 3000, &BER1, &V1);
+      apply_guard_bands_and_calculate(histogram, start_index, 3000, &BER2, &V2, GUARD_BAND);
+      printf("%s,%lf,%lf,%lf,%lf\n", GROUP, BER1, V1, BER2, V2);
+      fflush(stdout);
+    }
+    if (!options->follow)
+    {
+      break;
+    }
+    wait_for_file_change(options->filename, &notify_fd, &watch);
+  }
+
+  snapshot_free(&snapshot);
+}
+
+/*
+  Batch mode
+
+  A calibration campaign produces hundreds of captures. Every file is cut into line-aligned byte ranges
+  of at most BATCH_CHUNK_SIZE, and the chunks are scheduled on a work-stealing pool: every worker owns a
+  deque and, once it is empty, steals from another worker's. Chunks are dealt round-robin, largest files
+  first, and owner and thieves alike take the largest remaining chunk of a deque, so the chunks of a big
+  capture spread over all workers and no core idles while a few large files finish. A worker fills a private histogram per
+  chunk and adds it to the file's histogram under the file's lock (the first chunk donates its own); whoever finishes the last chunk of a
+  file runs the window and guard-band analysis. One row per file is printed in input order.
+  Rollover unwrapping needs the file in order, so with --counter-bits every file is a single chunk.
+*/
+
+#define BATCH_CHUNK_SIZE (64LL << 20) // Largest byte range parsed as one task
+
+struct batch_file
+{
+  const char *filename;
+  int64_t size;
+  int chunk_count;
+  int remaining;            // Chunks not finished yet
+  pthread_mutex_t lock;
+  int *histogram;           // Allocated by the first finished chunk, freed after the analysis
+  uint64_t events;
+  struct timespec started;  // When the first chunk started
+  int has_started;
+  double seconds;           // First chunk start to last chunk end
+  double BER1, V1, BER2, V2;
+};
+
+struct batch_task
+{
+  struct batch_file *file;
+  int64_t start, end;
+};
+
+// Deque of one worker, largest task at the top. The owner and thieves both take from the top, so the largest
+// remaining task always starts next; the bottom only grows while the chunks are dealt.
+struct work_deque
+{
+  pthread_mutex_t lock;
+  struct batch_task *tasks;
+  int top, bottom;
+};
+
+struct batch_pool
+{
+  struct work_deque *deques;
+  int workers;
+  const struct options *options;
+};
+
+struct batch_worker
+{
+  struct batch_pool *pool;
+  int index;
+  uint64_t steals;
+};
+
+// Function to take the next task: own deque first, then steal. Returns 0 when no work is left anywhere.
+int batch_next_task(struct batch_worker *worker, struct batch_task *task)
+{
+  struct batch_pool *pool = worker->pool;
+
+  for (int attempt = 0; attempt < pool->workers; attempt++)
+  {
+    int victim = (worker->index + attempt) % pool->workers;
+    struct work_deque *deque = &pool->deques[victim];
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom)
+    {
+      *task = deque->tasks[deque->top++];
+      found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    if (found)
+    {
+      worker->steals += attempt > 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Function to parse one chunk into a private histogram and fold it into its file
+void batch_run_task(const struct options *options, const struct batch_task *task, int **scratch)
+{
+  int *histogram = *scratch;
+  struct batch_file *file = task->file;
+  struct csv_reader reader;
+  struct rollover_unwrapper unwrapper;
+
+  pthread_mutex_lock(&file->lock);
+  if (!file->has_started)
+  {
+    file->has_started = 1;
+    clock_gettime(CLOCK_MONOTONIC, &file->started);
+  }
+  pthread_mutex_unlock(&file->lock);
+
+  csv_reader_open_range(&reader, file->filename, task->start, task->end);
+  struct tag_source source = {csv_reader_read, &reader};
+  struct tag_source unwrap_source = {rollover_unwrapper_read, &unwrapper};
+  if (options->counter_bits > 0)
+  {
+    rollover_unwrapper_init(&unwrapper, &source, options->counter_bits, options->overflow_channel);
+  }
+
+  uint64_t events = fill_histogram_from_source(options->counter_bits > 0 ? &unwrap_source : &source, histogram);
+  csv_reader_close(&reader);
+
+  // The first finished chunk hands its histogram to the file, the worker continues with a fresh one
+  pthread_mutex_lock(&file->lock);
+  if (file->histogram)
+  {
+    add_histograms(file->histogram, histogram, WINDOW_SIZE);
+  }
+  else
+  {
+    file->histogram = histogram;
+    *scratch = NULL;
+  }
+  file->events += events;
+  int last = (--file->remaining == 0);
+  pthread_mutex_unlock(&file->lock);
+
+  if (last)
+  {
+    int start_index = find_max_sum_window(file->histogram, WINDOW_SIZE, 3000, &file->BER1, &file->V1);
+    apply_guard_bands_and_calculate(file->histogram, start_index, 3000, &file->BER2, &file->V2, GUARD_BAND);
+    free(file->histogram);
+    file->histogram = NULL;
+    file->seconds = seconds_since(&file->started);
+  }
+}
+
+void *batch_worker_thread(void *argument)
+{
+  struct batch_worker *worker = argument;
+  struct batch_task task;
+  int *histogram = NULL;
+
+  while (batch_next_task(worker, &task))
+  {
+    if (!histogram && !(histogram = malloc(WINDOW_SIZE * sizeof(int))))
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+    batch_run_task(worker->pool->options, &task, &histogram);
+  }
+  free(histogram);
+  return NULL;
+}
+
+int compare_batch_files_by_size(const void *a, const void *b)
+{
+  const struct batch_file *x = *(struct batch_file *const *)a, *y = *(struct batch_file *const *)b;
+  return (x->size < y->size) - (x->size > y->size);
+}
+
+// Function to append the file names of a list file (one per line, "-" for stdin) to the inputs
+void read_batch_list(const char *list, const char ***names, int *count, int *capacity)
+{
+  FILE *file = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+  char line[4096];
+  if (!file)
+  {
+    printf("Error: Could not open file %s\n", list);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), file))
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0')
+    {
+      continue;
+    }
+    if (*count == *capacity)
+    {
+      *capacity = *capacity ? 2 * *capacity : 64;
+      *names = realloc(*names, *capacity * sizeof(const char *));
+    }
+    (*names)[(*count)++] = strdup(line);
+  }
+  if (file != stdin)
+  {
+    fclose(file);
+  }
+}
+
+// Function to analyze every input file on the work-stealing pool and print one row per file
+void run_batch(const struct options *options)
+{
+  const char **names = NULL;
+  int name_count = 0, name_capacity = 0;
+
+  // Expand the inputs: quoted glob patterns are matched here, list files are read
+  for (int i = 0; i < options->input_count; i++)
+  {
+    glob_t matches;
+    if (strpbrk(options->inputs[i], "*?[") && glob(options->inputs[i], 0, NULL, &matches) == 0)
+    {
+      for (size_t j = 0; j < matches.gl_pathc; j++)
+      {
+        if (name_count == name_capacity)
+        {
+          name_capacity = name_capacity ? 2 * name_capacity : 64;
+          names = realloc(names, name_capacity * sizeof(const char *));
+        }
+        names[name_count++] = strdup(matches.gl_pathv[j]);
+      }
+      globfree(&matches);
+      continue;
+    }
+    if (name_count == name_capacity)
+    {
+      name_capacity = name_capacity ? 2 * name_capacity : 64;
+      names = realloc(names, name_capacity * sizeof(const char *));
+    }
+    names[name_count++] = strdup(options->inputs[i]);
+  }
+  if (options->batch_list)
+  {
+    read_batch_list(options->batch_list, &names, &name_count, &name_capacity);
+  }
+  if (name_count == 0)
+  {
+    printf("Error: No input files\n");
+    exit(1);
+  }
+
+  struct batch_file *files = calloc(name_count, sizeof(struct batch_file));
+  struct batch_file **by_size = malloc(name_count * sizeof(struct batch_file *));
+  int total_chunks = 0;
+  int64_t total_bytes = 0;
+  if (!files || !by_size)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int i = 0; i < name_count; i++)
+  {
+    struct stat info;
+    if (stat(names[i], &info) != 0)
+    {
+      printf("Error: Could not open file %s\n", names[i]);
+      exit(1);
+    }
+    files[i].filename = names[i];
+    files[i].size = info.st_size;
+    files[i].chunk_count = options->counter_bits > 0 ? 1 : (int)((info.st_size + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE);
+    if (files[i].chunk_count == 0)
+    {
+      files[i].chunk_count = 1;
+    }
+    files[i].remaining = files[i].chunk_count;
+    pthread_mutex_init(&files[i].lock, NULL);
+    by_size[i] = &files[i];
+    total_chunks += files[i].chunk_count;
+    total_bytes += info.st_size;
+  }
+  qsort(by_size, name_count, sizeof(struct batch_file *), compare_batch_files_by_size);
+
+  // Deal the chunks round-robin, largest files first
+  struct batch_pool pool;
+  pool.workers = options->threads;
+  pool.options = options;
+  pool.deques = calloc(pool.workers, sizeof(struct work_deque));
+  if (!pool.deques)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int w = 0; w < pool.workers; w++)
+  {
+    pthread_mutex_init(&pool.deques[w].lock, NULL);
+    pool.deques[w].tasks = malloc((total_chunks / pool.workers + 1) * sizeof(struct batch_task));
+    if (!pool.deques[w].tasks)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+  int next_worker = 0;
+  for (int i = 0; i < name_count; i++)
+  {
+    struct batch_file *file = by_size[i];
+    int64_t chunk_size = options->counter_bits > 0 ? (file->size > 0 ? file->size : 1) : BATCH_CHUNK_SIZE;
+    for (int c = 0; c < file->chunk_count; c++)
+    {
+      struct work_deque *deque = &pool.deques[next_worker];
+      struct batch_task task = {file, c * chunk_size, c + 1 == file->chunk_count ? INT64_MAX : (c + 1) * chunk_size};
+      deque->tasks[deque->bottom++] = task;
+      next_worker = (next_worker + 1) % pool.workers;
+    }
+  }
+
+  struct timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  pthread_t *threads = malloc(pool.workers * sizeof(pthread_t));
+  struct batch_worker *workers = calloc(pool.workers, sizeof(struct batch_worker));
+  for (int w = 0; w < pool.workers; w++)
+  {
+    workers[w].pool = &pool;
+    workers[w].index = w;
+    if (pthread_create(&threads[w], NULL, batch_worker_thread, &workers[w]) != 0)
+    {
+      printf("Error: Could not start worker thread\n");
+      exit(1);
+    }
+  }
+  uint64_t steals = 0;
+  for (int w = 0; w < pool.workers; w++)
+  {
+    pthread_join(threads[w], NULL);
+    steals += workers[w].steals;
+  }
+  double seconds = seconds_since(&begin);
+
+  // One row per file: file,Group,BER1,V1,BER2,V2,events,seconds
+  for (int i = 0; i < name_count; i++)
+  {
+    printf("%s,%s,%lf,%lf,%lf,%lf,%llu,%.3f\n", files[i].filename, GROUP, files[i].BER1, files[i].V1, files[i].BER2,
+           files[i].V2, (unsigned long long)files[i].events, files[i].seconds);
+  }
+  printf("Batch: %d files, %d chunks, %.1f MB in %.3f s (%.1f MB/s) on %d threads, %llu steals\n", name_count,
+         total_chunks, total_bytes / 1e6, seconds, seconds > 0 ? total_bytes / 1e6 / seconds : 0.0, pool.workers,
+         (unsigned long long)steals);
+
+  for (int w = 0; w < pool.workers; w++)
+  {
+    free(pool.deques[w].tasks);
+    pthread_mutex_destroy(&pool.deques[w].lock);
+  }
+  for (int i = 0; i < name_count; i++)
+  {
+    pthread_mutex_destroy(&files[i].lock);
+    free((char *)names[i]);
+  }
+  free(pool.deques);
+  free(threads);
+  free(workers);
+  free(files);
+  free(by_size);
+  free(names);
+}
+
+/*
+  Sharded multi-process analysis
+
+  For the largest captures the file is split into line-aligned byte ranges that are parsed by forked
+  worker processes. Every worker bins its range into its own slot of a POSIX shared-memory segment and
+  marks the slot done; the coordinator waits for all workers, reduces the slots with SIMD adds and runs
+  the usual analysis. The segment is unlinked right after it is mapped, so nothing is left in /dev/shm
+  even if the coordinator is killed. A worker that crashes or exits with an error loses only its own
+  range: the coordinator reports it and runs the range again in a fresh process (SHARD_RETRIES times).
+  Sharding needs no ordering between ranges and is therefore not combined with the ordered ingest stages.
+*/
+
+#define SHARD_RETRIES 1 // Extra attempts for a range whose worker failed
+
+struct shard_slot
+{
+  uint64_t events;
+  int32_t done;             // Set by the worker after the histogram is complete
+  int32_t reserved;
+  int histogram[WINDOW_SIZE];
+};
+
+struct shard_report
+{
+  int processes;
+  int retries;
+  uint64_t events;
+  int64_t bytes;
+  double seconds;
+};
+
+// Function to fork a worker that bins [start, end) of the input into its slot
+pid_t start_shard_worker(const char *filename, int64_t start, int64_t end, struct shard_slot *slot)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    printf("Error: Could not start worker process\n");
+    exit(1);
+  }
+  if (pid == 0)
+  {
+    struct csv_reader reader;
+    csv_reader_open_range(&reader, filename, start, end);
+    struct tag_source source = {csv_reader_read, &reader};
+    slot->events = fill_histogram_from_source(&source, slot->histogram);
+    csv_reader_close(&reader);
+    __atomic_store_n(&slot->done, 1, __ATOMIC_RELEASE);
+    _exit(0);
+  }
+  return pid;
+}
+
+// Function to analyze the input with forked worker processes and reduce their shared-memory histograms
+void sharded_fill_histogram(const struct options *options, int *histogram, struct shard_report *report)
+{
+  int processes = options->processes;
+  size_t segment_size = processes * sizeof(struct shard_slot);
+  char name[64];
+  struct stat info;
+  struct timespec begin;
+
+  if (stat(options->filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", options->filename);
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  snprintf(name, sizeof(name), "/qber-shards-%ld", (long)getpid());
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+  {
+    printf("Error: Could not create shared memory segment %s\n", name);
+    exit(1);
+  }
+  if (ftruncate(fd, segment_size) != 0)
+  {
+    printf("Error: Could not size shared memory segment %s\n", name);
+    exit(1);
+  }
+  struct shard_slot *slots = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  shm_unlink(name);
+  close(fd);
+  if (slots == MAP_FAILED)
+  {
+    printf("Error: Could not map shared memory segment %s\n", name);
+    exit(1);
+  }
+
+  pid_t *workers = malloc(processes * sizeof(pid_t));
+  int *attempts = calloc(processes, sizeof(int));
+  if (!workers || !attempts)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int i = 0; i < processes; i++)
+  {
+    workers[i] = start_shard_worker(options->filename, info.st_size * i / processes,
+                                    i + 1 == processes ? INT64_MAX : info.st_size * (i + 1) / processes, &slots[i]);
+  }
+
+  report->retries = 0;
+  for (int running = processes; running > 0;)
+  {
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0)
+    {
+      printf("Error: Lost track of worker processes\n");
+      exit(1);
+    }
+    int i = 0;
+    while (i < processes && workers[i] != pid)
+    {
+      i++;
+    }
+    if (i == processes)
+    {
+      continue;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && __atomic_load_n(&slots[i].done, __ATOMIC_ACQUIRE))
+    {
+      running--;
+      continue;
+    }
+
+    // Only this range is lost: run it again
+    int64_t start = info.st_size * i / processes;
+    int64_t end = i + 1 == processes ? info.st_size : info.st_size * (i + 1) / processes;
+    if (WIFSIGNALED(status))
+    {
+      printf("Warning: Worker for bytes %lld-%lld was killed by signal %d\n", (long long)start, (long long)end,
+             WTERMSIG(status));
+    }
+    else
+    {
+      printf("Warning: Worker for bytes %lld-%lld failed\n", (long long)start, (long long)end);
+    }
+    if (attempts[i]++ == SHARD_RETRIES)
+    {
+      printf("Error: Giving up on bytes %lld-%lld of %s\n", (long long)start, (long long)end, options->filename);
+      exit(1);
+    }
+    report->retries++;
+    memset(&slots[i], 0, sizeof(struct shard_slot));
+    workers[i] = start_shard_worker(options->filename, start, i + 1 == processes ? INT64_MAX : end, &slots[i]);
+  }
+
+  // Reduce the slots
+  memcpy(histogram, slots[0].histogram, WINDOW_SIZE * sizeof(int));
+  report->events = slots[0].events;
+  for (int i = 1; i < processes; i++)
+  {
+    add_histograms(histogram, slots[i].histogram, WINDOW_SIZE);
+    report->events += slots[i].events;
+  }
+  report->processes = processes;
+  report->bytes = info.st_size;
+  report->seconds = seconds_since(&begin);
+
+  munmap(slots, segment_size);
+  free(workers);
+  free(attempts);
+}
+
+void print_shard_report(const struct shard_report *report)
+{
+  printf("Shards: %d processes, %llu events, %.1f MB in %.3f s (%.1f MB/s), %d retried\n", report->processes,
+         (unsigned long long)report->events, report->bytes / 1e6, report->seconds,
+         report->seconds > 0 ? report->bytes / 1e6 / report->seconds : 0.0, report->retries);
+}
+
+/*
+  NUMA-aware parallel ingest
+
+  The capture is memory-mapped and cut into one contiguous partition per NUMA node, sized by the node's
+  share of the worker threads; each partition is cut again into one line-aligned range per thread. Every
+  thread is bound to the CPUs of its node, pre-faults its range with MADV_WILLNEED and allocates and
+  clears its private histogram itself, so with the default first-touch policy both the page-cache pages
+  it reads and the histogram it writes live on its own node. Because the partitioning is deterministic,
+  pages cached by an earlier run are found again on the node that reads them. The reduction is
+  hierarchical: threads add into their node's histogram (the first one to finish donates its own), and
+  only the node histograms cross the interconnect in the final sum. Nodes and their CPUs come from
+  /sys/devices/system/node; without it the machine is treated as a single node.
+*/
+
+#define MAX_NUMA_NODES 64
+
+struct numa_node
+{
+  int id;
+  cpu_set_t cpus;
+  int cpu_count;
+  int threads;
+  int remaining;            // Threads of the node still running
+  pthread_mutex_t lock;
+  int *histogram;           // Node-level reduction, allocated on the node
+  int64_t bytes;
+  uint64_t events;
+  struct timespec started;
+  double seconds;
+};
+
+struct numa_worker
+{
+  struct numa_node *node;
+  const char *data;         // Mapped file
+  int64_t size;
+  int64_t start, end;       // Byte range, aligned to lines by the worker
+};
+
+// Function to parse a cpulist such as "0-3,8-11" into a CPU set
+void parse_cpulist(const char *list, cpu_set_t *cpus)
+{
+  CPU_ZERO(cpus);
+  while (*list)
+  {
+    char *next;
+    long first = strtol(list, &next, 10), last = first;
+    if (next == list)
+    {
+      break;
+    }
+    if (*next == '-')
+    {
+      last = strtol(next + 1, &next, 10);
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+    {
+      CPU_SET(cpu, cpus);
+    }
+    list = *next == ',' ? next + 1 : next + (*next != '\0');
+  }
+}
+
+// Function to list the NUMA nodes with CPUs this process may run on, returns the node count
+int discover_numa_nodes(struct numa_node *nodes)
+{
+  cpu_set_t allowed;
+  int count = 0;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+  {
+    CPU_ZERO(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      CPU_SET(cpu, &allowed);
+    }
+  }
+
+  for (int id = 0; id < 1024 && count < MAX_NUMA_NODES; id++)
+  {
+    char path[128], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+      continue;
+    }
+    if (fgets(list, sizeof(list), file))
+    {
+      memset(&nodes[count], 0, sizeof(struct numa_node));
+      parse_cpulist(list, &nodes[count].cpus);
+      CPU_AND(&nodes[count].cpus, &nodes[count].cpus, &allowed);
+      nodes[count].id = id;
+      nodes[count].cpu_count = CPU_COUNT(&nodes[count].cpus);
+      count += nodes[count].cpu_count > 0;
+    }
+    fclose(file);
+  }
+
+  if (count == 0)
+  {
+    memset(&nodes[0], 0, sizeof(struct numa_node));
+    nodes[0].cpus = allowed;
+    nodes[0].cpu_count = CPU_COUNT(&allowed);
+    count = 1;
+  }
+  return count;
+}
+
+void *numa_worker_thread(void *argument)
+{
+  struct numa_worker *worker = argument;
+  struct numa_node *node = worker->node;
+  const char *p = worker->data + worker->start;
+  const char *end = worker->data + worker->end;
+  const char *file_end = worker->data + worker->size;
+
+  // Pre-fault the range from this node (page-aligned start)
+  long page = sysconf(_SC_PAGESIZE);
+  int64_t advise_start = worker->start / page * page;
+  if (worker->end > advise_start)
+  {
+    madvise((char *)worker->data + advise_start, worker->end - advise_start, MADV_WILLNEED);
+  }
+
+  // First touch by this thread places the private histogram on its node
+  int *histogram = calloc(WINDOW_SIZE, sizeof(int));
+  if (!histogram)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  // A range owns the lines that start inside it; the range at offset 0 skips the header row, as csv_reader does
+  if (worker->start == 0 || p[-1] != '\n')
+  {
+    const char *newline = memchr(p, '\n', file_end - p);
+    p = newline ? newline + 1 : file_end;
+  }
+  uint64_t events = 0;
+  while (p < end)
+  {
+    const char *newline = memchr(p, '\n', file_end - p);
+    const char *line_end = newline ? newline : file_end;
+    struct time_tag tag;
+    if (parse_time_tag_line(p, line_end, &tag))
+    {
+      histogram[window_bin(tag.timestamp)]++;
+      events++;
+    }
+    p = newline ? newline + 1 : file_end;
+  }
+
+  // First level of the reduction: into the node histogram
+  pthread_mutex_lock(&node->lock);
+  if (node->histogram)
+  {
+    add_histograms(node->histogram, histogram, WINDOW_SIZE);
+    free(histogram);
+  }
+  else
+  {
+    node->histogram = histogram;
+  }
+  node->events += events;
+  if (--node->remaining == 0)
+  {
+    node->seconds = seconds_since(&node->started);
+  }
+  pthread_mutex_unlock(&node->lock);
+  return NULL;
+}
+
+// Function to fill the histogram with threads bound per NUMA node and print per-node throughput afterwards
+void numa_fill_histogram(const struct options *options, int *histogram, struct numa_node *nodes, int *node_count)
+{
+  int fd = open(options->filename, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", options->filename);
+    exit(1);
+  }
+  memset(histogram, 0, WINDOW_SIZE * sizeof(int));
+  *node_count = discover_numa_nodes(nodes);
+  if (info.st_size == 0)
+  {
+    close(fd);
+    return;
+  }
+  const char *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    printf("Error: Could not map file %s\n", options->filename);
+    exit(1);
+  }
+
+  // Threads per node in proportion to the node's CPUs, at least one each
+  int total_cpus = 0, total_threads = 0;
+  for (int n = 0; n < *node_count; n++)
+  {
+    total_cpus += nodes[n].cpu_count;
+  }
+  for (int n = 0; n < *node_count; n++)
+  {
+    nodes[n].threads = (int)((int64_t)options->threads * nodes[n].cpu_count / total_cpus);
+    nodes[n].threads = nodes[n].threads > 0 ? nodes[n].threads : 1;
+    nodes[n].remaining = nodes[n].threads;
+    total_threads += nodes[n].threads;
+    pthread_mutex_init(&nodes[n].lock, NULL);
+  }
+
+  struct numa_worker *workers = malloc(total_threads * sizeof(struct numa_worker));
+  pthread_t *threads = malloc(total_threads * sizeof(pthread_t));
+  if (!workers || !threads)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  int w = 0, assigned = 0;
+  for (int n = 0; n < *node_count; n++)
+  {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setaffinity_np(&attributes, sizeof(cpu_set_t), &nodes[n].cpus);
+    clock_gettime(CLOCK_MONOTONIC, &nodes[n].started);
+    for (int t = 0; t < nodes[n].threads; t++, w++, assigned++)
+    {
+      workers[w].node = &nodes[n];
+      workers[w].data = data;
+      workers[w].size = info.st_size;
+      workers[w].start = info.st_size * assigned / total_threads;
+      workers[w].end = info.st_size * (assigned + 1) / total_threads;
+      nodes[n].bytes += workers[w].end - workers[w].start;
+      if (pthread_create(&threads[w], &attributes, numa_worker_thread, &workers[w]) != 0)
+      {
+        printf("Error: Could not start worker thread\n");
+        exit(1);
+      }
+    }
+    pthread_attr_destroy(&attributes);
+  }
+  for (w = 0; w < total_threads; w++)
+  {
+    pthread_join(threads[w], NULL);
+  }
+
+  // Second level: across nodes
+  for (int n = 0; n < *node_count; n++)
+  {
+    add_histograms(histogram, nodes[n].histogram, WINDOW_SIZE);
+    free(nodes[n].histogram);
+    nodes[n].histogram = NULL;
+    pthread_mutex_destroy(&nodes[n].lock);
+  }
+  munmap((void *)data, info.st_size);
+  free(workers);
+  free(threads);
+}
+
+void print_numa_report(const struct numa_node *nodes, int node_count)
+{
+  for (int n = 0; n < node_count; n++)
+  {
+    printf("NUMA node %d: %d threads on %d CPUs, %llu events, %.1f MB in %.3f s (%.1f MB/s)\n", nodes[n].id,
+           nodes[n].threads, nodes[n].cpu_count, (unsigned long long)nodes[n].events, nodes[n].bytes / 1e6,
+           nodes[n].seconds, nodes[n].seconds > 0 ? nodes[n].bytes / 1e6 / nodes[n].seconds : 0.0);
+  }
+}
+
+/*
+  Block sampling and early stopping
+
+  For a quick link check the whole capture is not needed. The file is cut into SAMPLE_BLOCK_SIZE blocks
+  that are read with pread in an order that covers the whole capture early: strided (bit-reversed block
+  numbers, so every pass halves the gaps between the blocks read so far) or random (a seeded shuffle).
+  A block owns the lines that start inside it. After every block the peak window is searched again and
+  Wilson intervals of BER1 and BER2 are computed from the window counts; reading stops once both
+  half-widths are below --target-precision (after at least SAMPLE_MIN_BLOCKS blocks) or the file is
+  exhausted. The intervals treat the sampled events as independent, which holds as long as the error
+  rate does not drift within a block; blocks are small compared to typical drift times.
+*/
+
+#define SAMPLE_BLOCK_SIZE (1 << 20) // Bytes per sampled block
+#define SAMPLE_LINE_SLACK 4096      // Extra bytes read to finish the last line of a block
+#define SAMPLE_MIN_BLOCKS 4         // Blocks read before the stopping rule is checked
+
+struct block_sampler
+{
+  int fd;
+  int64_t size;
+  int64_t block_count;
+  int64_t block_size;
+  int64_t *order;      // Visit order of the blocks
+  int64_t visit_count; // Blocks in order
+  int64_t next;        // Position in order
+  char *buffer;        // block_size + SAMPLE_LINE_SLACK + 1 bytes
+  int64_t bytes_read; // Bytes of the blocks consumed so far
+};
+
+struct sample_report
+{
+  int64_t blocks_read, block_count;
+  int64_t bytes_read, size;
+  uint64_t events;
+  double half_width[2]; // BER1, BER2
+  double level;
+  int converged;
+  double seconds;
+};
+
+// Function to reverse the lowest `bits` bits of value
+int64_t reverse_bits(int64_t value, int bits)
+{
+  int64_t reversed = 0;
+  for (int b = 0; b < bits; b++)
+  {
+    reversed = (reversed << 1) | ((value >> b) & 1);
+  }
+  return reversed;
+}
+
+int compare_int64(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Function to open a file for block sampling. With count > 0 only a simple random sample of count distinct blocks
+// is visited, in file order; otherwise every block is visited in the given order.
+void block_sampler_open(struct block_sampler *sampler, const char *filename, int64_t block_size, int order,
+                        int64_t count, uint64_t seed)
+{
+  struct stat info;
+  sampler->fd = open(filename, O_RDONLY);
+  if (sampler->fd < 0 || fstat(sampler->fd, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+  sampler->size = info.st_size;
+  sampler->block_size = block_size;
+  sampler->block_count = (info.st_size + block_size - 1) / block_size;
+  sampler->visit_count = count > 0 && count < sampler->block_count ? count : sampler->block_count;
+  sampler->order = malloc((sampler->visit_count ? sampler->visit_count : 1) * sizeof(int64_t));
+  sampler->buffer = malloc(block_size + SAMPLE_LINE_SLACK + 1);
+  sampler->next = 0;
+  sampler->bytes_read = 0;
+  if (!sampler->order || !sampler->buffer)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  if (sampler->visit_count < sampler->block_count)
+  {
+    // Draw, sort and drop duplicates until enough distinct blocks are chosen
+    int64_t chosen = 0;
+    while (chosen < sampler->visit_count)
+    {
+      for (int64_t i = chosen; i < sampler->visit_count; i++)
+      {
+        sampler->order[i] = (int64_t)(splitmix64_next(&seed) % (uint64_t)sampler->block_count);
+      }
+      qsort(sampler->order, sampler->visit_count, sizeof(int64_t), compare_int64);
+      chosen = 0;
+      for (int64_t i = 0; i < sampler->visit_count; i++)
+      {
+        if (chosen == 0 || sampler->order[i] != sampler->order[chosen - 1])
+        {
+          sampler->order[chosen++] = sampler->order[i];
+        }
+      }
+    }
+  }
+  else if (order == SAMPLE_ORDER_RANDOM)
+  {
+    for (int64_t i = 0; i < sampler->block_count; i++)
+    {
+      sampler->order[i] = i;
+    }
+    for (int64_t i = sampler->block_count - 1; i > 0; i--)
+    {
+      int64_t j = (int64_t)(splitmix64_next(&seed) % (uint64_t)(i + 1));
+      int64_t swap = sampler->order[i];
+      sampler->order[i] = sampler->order[j];
+      sampler->order[j] = swap;
+    }
+  }
+  else
+  {
+    // Bit-reversed counting over the next power of two, skipping numbers past the last block
+    int bits = 0;
+    while (((int64_t)1 << bits) < sampler->block_count)
+    {
+      bits++;
+    }
+    int64_t count = 0;
+    for (int64_t i = 0; i < ((int64_t)1 << bits); i++)
+    {
+      int64_t block = reverse_bits(i, bits);
+      if (block < sampler->block_count)
+      {
+        sampler->order[count++] = block;
+      }
+    }
+  }
+}
+
+void block_sampler_close(struct block_sampler *sampler)
+{
+  close(sampler->fd);
+  free(sampler->order);
+  free(sampler->buffer);
+}
+
+// Function to parse the lines that start in a byte range of the file into time tags, calling add() for every
+// tag. Returns the number of tags.
+uint64_t block_sampler_read_range(struct block_sampler *sampler, int64_t start, int64_t end,
+                                  void (*add)(void *, const struct time_tag *), void *context)
+{
+  // Read one byte before the range to know whether it starts on a line boundary
+  int64_t first = start > 0 ? start - 1 : 0;
+  int64_t last = end + SAMPLE_LINE_SLACK < sampler->size ? end + SAMPLE_LINE_SLACK : sampler->size;
+  ssize_t length = pread(sampler->fd, sampler->buffer, last - first, first);
+  if (length < 0)
+  {
+    printf("Error: Could not read the input\n");
+    exit(1);
+  }
+
+  const char *p = sampler->buffer + (start - first);
+  const char *limit = sampler->buffer + (end - first < length ? end - first : length);
+  const char *data_end = sampler->buffer + length;
+
+  // Skip the partial first line, or at offset 0 the header row, as csv_reader_open_range does
+  if (start == 0 || p[-1] != '\n')
+  {
+    const char *newline = memchr(p, '\n', data_end - p);
+    p = newline ? newline + 1 : data_end;
+  }
+
+  uint64_t events = 0;
+  while (p < limit)
+  {
+    const char *newline = memchr(p, '\n', data_end - p);
+    const char *line_end = newline ? newline : data_end;
+    struct time_tag tag;
+    if (parse_time_tag_line(p, line_end, &tag))
+    {
+      add(context, &tag);
+      events++;
+    }
+    p = newline ? newline + 1 : data_end;
+  }
+  return events;
+}
+
+// Function to read the next block in the visit order; returns 0 when every block has been read
+int block_sampler_next(struct block_sampler *sampler, void (*add)(void *, const struct time_tag *), void *context,
+                       uint64_t *events)
+{
+  if (sampler->next >= sampler->visit_count)
+  {
+    return 0;
+  }
+  int64_t start = sampler->order[sampler->next++] * sampler->block_size;
+  int64_t end = start + sampler->block_size < sampler->size ? start + sampler->block_size : sampler->size;
+  *events += block_sampler_read_range(sampler, start, end, add, context);
+  sampler->bytes_read += end - start;
+  return 1;
+}
+
+void add_tag_to_histogram(void *context, const struct time_tag *tag)
+{
+  int *histogram = context;
+  histogram[window_bin(tag->timestamp)]++;
+}
+
+// Function to fill the histogram from sampled blocks until BER1 and BER2 are known to the target precision
+void sampled_fill_histogram(const struct options *options, int *histogram, struct sample_report *report)
+{
+  struct block_sampler sampler;
+  struct timespec begin;
+  double level = options->confidence > 0 ? options->confidence : DEFAULT_CONFIDENCE;
+  double z = normal_quantile(level);
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  memset(histogram, 0, WINDOW_SIZE * sizeof(int));
+  memset(report, 0, sizeof(*report));
+  block_sampler_open(&sampler, options->filename, SAMPLE_BLOCK_SIZE, options->sample_order, 0, options->seed);
+
+  while (block_sampler_next(&sampler, add_tag_to_histogram, histogram, &report->events))
+  {
+    report->blocks_read++;
+    if (report->blocks_read < SAMPLE_MIN_BLOCKS && report->blocks_read < sampler.block_count)
+    {
+      continue;
+    }
+
+    double BER1, V1, low, high;
+    struct window_counts counts;
+    int start_index = find_max_sum_window(histogram, WINDOW_SIZE, 3000, &BER1, &V1);
+    count_window_events(histogram, start_index, 3000, GUARD_BAND, 1, 1, &counts);
+    int64_t kept = counts.kept[0] + counts.kept[1] + counts.kept[2];
+    wilson_interval(counts.kept[1] + counts.guarded[1], kept + counts.guarded[0] + counts.guarded[1] + counts.guarded[2],
+                    z, &low, &high);
+    report->half_width[0] = (high - low) / 2;
+    wilson_interval(counts.kept[1], kept, z, &low, &high);
+    report->half_width[1] = (high - low) / 2;
+    if (report->half_width[0] <= options->target_precision && report->half_width[1] <= options->target_precision)
+    {
+      report->converged = 1;
+      break;
+    }
+  }
+
+  report->block_count = sampler.block_count;
+  report->bytes_read = sampler.bytes_read;
+  report->size = sampler.size;
+  report->level = level;
+  report->seconds = seconds_since(&begin);
+  block_sampler_close(&sampler);
+}
+
+void print_sample_report(const struct sample_report *report)
+{
+  printf("Sampling: %s after %lld of %lld blocks (%.3f%% of %.1f MB, %llu events) in %.3f s; "
+         "BER1 +-%lf, BER2 +-%lf at %.1f%%\n",
+         report->converged ? "target precision reached" : "input exhausted", (long long)report->blocks_read,
+         (long long)report->block_count, report->size > 0 ? 100.0 * report->bytes_read / report->size : 0.0,
+         report->size / 1e6, (unsigned long long)report->events, report->seconds, report->half_width[0],
+         report->half_width[1], report->level * 100);
+}
+
+/*
+  Sampling preview
+
+  --preview reads a simple random sample of PREVIEW_BLOCK_SIZE blocks (chosen without replacement from the
+  block offsets of the file and read in file order with pread), so a preview of any capture touches only a few
+  MB. The printed row is the analysis of the sampled histogram. Every metric is a ratio of two window totals,
+  so its error bound comes from the design-based variance of the ratio estimator over the sampled blocks
+  (with the finite-population correction). Blocks are the sampling units, which keeps the bound valid when
+  events within a block are correlated, e.g. by a drifting error rate. The bound is conditional on the peak
+  window found in the sample.
+*/
+
+#define PREVIEW_BLOCK_SIZE (16 * 1024) // Bytes per preview block
+
+struct preview_sample
+{
+  int *histogram;
+  int32_t *positions;   // Histogram bin of every sampled tag, block after block
+  size_t count, capacity;
+};
+
+struct preview_report
+{
+  int64_t blocks_read, block_count;
+  int64_t bytes_read, size;
+  uint64_t events;
+  double low[4], high[4]; // BER1, V1, BER2, V2
+  double level;
+  double seconds;
+};
+
+void add_tag_to_preview(void *context, const struct time_tag *tag)
+{
+  struct preview_sample *sample = context;
+  int mod_timestamp = window_bin(tag->timestamp);
+  if (sample->count == sample->capacity)
+  {
+    sample->capacity = sample->capacity ? 2 * sample->capacity : 65536;
+    sample->positions = realloc(sample->positions, sample->capacity * sizeof(int32_t));
+    if (!sample->positions)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+  }
+  sample->positions[sample->count++] = mod_timestamp;
+  sample->histogram[mod_timestamp]++;
+}
+
+// Function to calculate the interval of the ratio sum(y) / sum(x) from per-block totals of a simple random
+// sample of n blocks, a fraction f of all blocks
+void ratio_interval(const double *y, const double *x, int64_t n, double f, double z, double *low, double *high)
+{
+  double sum_y = 0, sum_x = 0, residuals = 0;
+  for (int64_t b = 0; b < n; b++)
+  {
+    sum_y += y[b];
+    sum_x += x[b];
+  }
+  double ratio = sum_y / sum_x;
+  for (int64_t b = 0; b < n; b++)
+  {
+    double e = y[b] - ratio * x[b];
+    residuals += e * e;
+  }
+  double mean_x = sum_x / n;
+  double variance = n > 1 ? (1 - f) * residuals / (n - 1) / (n * mean_x * mean_x) : INFINITY;
+  double half = z * sqrt(variance);
+  *low = ratio - half;
+  *high = ratio + half;
+}
+
+// Function to fill the histogram from a random sample of blocks and bound the error of BER1, V1, BER2 and V2
+void preview_fill_histogram(const struct options *options, int *histogram, struct preview_report *report)
+{
+  struct block_sampler sampler;
+  struct preview_sample sample = {histogram, NULL, 0, 0};
+  struct timespec begin;
+  double BER1, V1;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  memset(histogram, 0, WINDOW_SIZE * sizeof(int));
+  memset(report, 0, sizeof(*report));
+  report->level = options->confidence > 0 ? options->confidence : DEFAULT_CONFIDENCE;
+  block_sampler_open(&sampler, options->filename, PREVIEW_BLOCK_SIZE, SAMPLE_ORDER_RANDOM, options->preview_blocks,
+                     options->seed);
+
+  size_t *block_end = malloc((sampler.visit_count + 1) * sizeof(size_t));
+  if (!block_end)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  while (block_sampler_next(&sampler, add_tag_to_preview, &sample, &report->events))
+  {
+    block_end[report->blocks_read++] = sample.count;
+  }
+
+  // Per-block numerator and denominator of each metric, see window_counts_metrics()
+  int64_t n = report->blocks_read;
+  double *totals = calloc(8 * (n ? n : 1), sizeof(double));
+  if (!totals)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  int start_index = find_max_sum_window(histogram, WINDOW_SIZE, 3000, &BER1, &V1);
+  size_t first = 0;
+  for (int64_t b = 0; b < n; b++)
+  {
+    int64_t parts[6] = {0};
+    for (size_t t = first; t < block_end[b]; t++)
+    {
+      int i = sample.positions[t];
+      if (i >= start_index && i < start_index + 3000)
+      {
+        parts[window_bin_class(i, start_index, 3000, GUARD_BAND, 1, 1)]++;
+      }
+    }
+    first = block_end[b];
+    double C1 = parts[0] + parts[3], D1 = parts[1] + parts[4], C2 = parts[2] + parts[5];
+    totals[0 * n + b] = D1;
+    totals[1 * n + b] = C1 + D1 + C2;
+    totals[2 * n + b] = C1 + C2;
+    totals[3 * n + b] = D1;
+    totals[4 * n + b] = parts[1];
+    totals[5 * n + b] = parts[0] + parts[1] + parts[2];
+    totals[6 * n + b] = parts[0] + parts[2];
+    totals[7 * n + b] = parts[1];
+  }
+  double f = sampler.block_count ? (double)n / sampler.block_count : 1;
+  double z = normal_quantile(report->level);
+  for (int m = 0; m < 4; m++)
+  {
+    ratio_interval(totals + 2 * m * n, totals + (2 * m + 1) * n, n, f, z, &report->low[m], &report->high[m]);
+  }
+
+  report->block_count = sampler.block_count;
+  report->bytes_read = sampler.bytes_read;
+  report->size = sampler.size;
+  report->seconds = seconds_since(&begin);
+  free(totals);
+  free(block_end);
+  free(sample.positions);
+  block_sampler_close(&sampler);
+}
+
+void print_preview_report(const struct preview_report *report)
+{
+  const char *names[4] = {"BER1", "V1", "BER2", "V2"};
+  printf("Preview %.1f%% (%lld of %lld blocks, %.3f%% of %.1f MB, %llu events, %.3f s):", report->level * 100,
+         (long long)report->blocks_read, (long long)report->block_count,
+         report->size > 0 ? 100.0 * report->bytes_read / report->size : 0.0, report->size / 1e6,
+         (unsigned long long)report->events, report->seconds);
+  for (int m = 0; m < 4; m++)
+  {
+    printf(" %s [%lf, %lf]", names[m], report->low[m], report->high[m]);
+  }
+  printf("\n");
+}
+
+/*
+  Sparse byte-offset index
+
+  A capture can carry a sidecar index <file>.qidx: every --index-lines lines it records the byte offset of the
+  line and the smallest and largest timestamp of the lines up to the next entry. --time-range <start>:<end>
+  then reads only the blocks whose [min, max] overlaps the range, each with a single pread, and bins the tags
+  with start <= timestamp < end. Blocks keep min and max rather than relying on time order, so unsorted
+  captures are indexed correctly (a disordered block is merely read more often). The index stores the file
+  fingerprint and modification time, and is rebuilt when either changes, so an edit in place that keeps the
+  size is caught as well.
+*/
+
+#define INDEX_MAGIC "QBERINDX" // 8 bytes, no terminator stored
+#define INDEX_VERSION 2
+#define INDEX_SUFFIX ".qidx"
+
+struct index_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;    // sizeof(struct index_header), for forward compatibility
+  int64_t file_size;
+  uint64_t fingerprint;    // file_fingerprint() of the indexed capture
+  int64_t mtime_sec;       // st_mtim of the indexed capture
+  int64_t mtime_nsec;
+  int64_t lines_per_entry;
+  int64_t entry_count;
+  int64_t max_block_bytes; // Largest distance between consecutive entries
+};
+
+struct index_entry
+{
+  int64_t offset;        // Start of the block's first line; the block ends at the next entry or end of file
+  int64_t min_timestamp; // INT64_MAX / INT64_MIN if the block holds no timestamp
+  int64_t max_timestamp;
+};
+
+struct offset_index
+{
+  struct index_header header;
+  struct index_entry *entries;
+};
+
+struct range_report
+{
+  int64_t blocks_read, block_count;
+  int64_t bytes_read, size;
+  uint64_t events;
+  int built;
+  double seconds;
+};
+
+struct range_histogram
+{
+  int *histogram;
+  int64_t start, end;
+  uint64_t events;
+};
+
+// Function to return the sidecar index path of a capture (static buffer)
+const char *index_path(const char *filename)
+{
+  static char path[4096];
+  snprintf(path, sizeof(path), "%s%s", filename, INDEX_SUFFIX);
+  return path;
+}
+
+// Function to scan a capture once and record an index entry every lines_per_entry lines
+void index_build(struct offset_index *index, const char *filename, int64_t lines_per_entry)
+{
+  struct csv_reader reader;
+  struct stat info;
+  const char *line_end;
+  int64_t lines = 0, capacity = 1024;
+
+  if (stat(filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+  memset(&index->header, 0, sizeof(index->header));
+  memcpy(index->header.magic, INDEX_MAGIC, 8);
+  index->header.version = INDEX_VERSION;
+  index->header.header_size = sizeof(index->header);
+  index->header.fingerprint = file_fingerprint(filename);
+  index->header.mtime_sec = info.st_mtim.tv_sec;
+  index->header.mtime_nsec = info.st_mtim.tv_nsec;
+  index->header.lines_per_entry = lines_per_entry;
+  index->entries = malloc(capacity * sizeof(struct index_entry));
+  if (!index->entries)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  csv_reader_open(&reader, filename);
+  while ((line_end = csv_reader_next_line(&reader)))
+  {
+    if (lines++ % lines_per_entry == 0)
+    {
+      if (index->header.entry_count == capacity)
+      {
+        capacity *= 2;
+        index->entries = realloc(index->entries, capacity * sizeof(struct index_entry));
+        if (!index->entries)
+        {
+          printf("Error: Out of memory\n");
+          exit(1);
+        }
+      }
+      struct index_entry *entry = &index->entries[index->header.entry_count++];
+      entry->offset = csv_reader_offset(&reader);
+      entry->min_timestamp = INT64_MAX;
+      entry->max_timestamp = INT64_MIN;
+    }
+
+    struct time_tag tag;
+    struct index_entry *entry = &index->entries[index->header.entry_count - 1];
+    if (parse_time_tag_line(reader.buffer + reader.position, line_end, &tag))
+    {
+      entry->min_timestamp = tag.timestamp < entry->min_timestamp ? tag.timestamp : entry->min_timestamp;
+      entry->max_timestamp = tag.timestamp > entry->max_timestamp ? tag.timestamp : entry->max_timestamp;
+    }
+    reader.position = line_end - reader.buffer + (line_end < reader.buffer + reader.length);
+  }
+  index->header.file_size = csv_reader_offset(&reader);
+  csv_reader_close(&reader);
+
+  for (int64_t i = 0; i < index->header.entry_count; i++)
+  {
+    int64_t end = i + 1 < index->header.entry_count ? index->entries[i + 1].offset : index->header.file_size;
+    if (end - index->entries[i].offset > index->header.max_block_bytes)
+    {
+      index->header.max_block_bytes = end - index->entries[i].offset;
+    }
+  }
+}
+
+void index_save(const struct offset_index *index, const char *filename)
+{
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    printf("Error: Could not create file %s\n", filename);
+    exit(1);
+  }
+  write_all(fd, &index->header, sizeof(index->header));
+  write_all(fd, index->entries, index->header.entry_count * sizeof(struct index_entry));
+  close(fd);
+}
+
+// Function to load an index file; returns 0 if it is missing, malformed or was built for another capture or an
+// earlier modification of this one
+int index_load(struct offset_index *index, const char *filename, uint64_t fingerprint, const struct timespec *mtime)
+{
+  FILE *file = fopen(filename, "rb");
+  index->entries = NULL;
+  if (!file)
+  {
+    return 0;
+  }
+  int valid = fread(&index->header, sizeof(index->header), 1, file) == 1 &&
+              memcmp(index->header.magic, INDEX_MAGIC, 8) == 0 && index->header.version == INDEX_VERSION &&
+              index->header.header_size == sizeof(index->header) && index->header.fingerprint == fingerprint &&
+              index->header.mtime_sec == mtime->tv_sec && index->header.mtime_nsec == mtime->tv_nsec &&
+              index->header.entry_count >= 0;
+  if (valid)
+  {
+    size_t count = index->header.entry_count;
+    index->entries = malloc((count ? count : 1) * sizeof(struct index_entry));
+    valid = index->entries && fread(index->entries, sizeof(struct index_entry), count, file) == count;
+  }
+  fclose(file);
+  if (!valid)
+  {
+    free(index->entries);
+    index->entries = NULL;
+  }
+  return valid;
+}
+
+// Function to load the capture's sidecar index, rebuilding and saving it if it is missing or stale.
+// Returns 1 if the index was built.
+int index_open(struct offset_index *index, const char *filename, int64_t lines_per_entry)
+{
+  struct stat info;
+  if (stat(filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", filename);
+    exit(1);
+  }
+  if (index_load(index, index_path(filename), file_fingerprint(filename), &info.st_mtim))
+  {
+    return 0;
+  }
+  index_build(index, filename, lines_per_entry);
+  index_save(index, index_path(filename));
+  return 1;
+}
+
+void index_free(struct offset_index *index)
+{
+  free(index->entries);
+}
+
+// Function to build and save the sidecar index of the input (--build-index)
+void run_build_index(const struct options *options)
+{
+  struct offset_index index;
+  struct timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  index_build(&index, options->filename, options->index_lines);
+  index_save(&index, index_path(options->filename));
+  printf("Index: %s, %lld entries of %lld lines for %.1f MB in %.3f s\n", index_path(options->filename),
+         (long long)index.header.entry_count, (long long)index.header.lines_per_entry,
+         index.header.file_size / 1e6, seconds_since(&begin));
+  index_free(&index);
+}
+
+void add_tag_in_range(void *context, const struct time_tag *tag)
+{
+  struct range_histogram *range = context;
+  if (tag->timestamp >= range->start && tag->timestamp < range->end)
+  {
+    add_tag_to_histogram(range->histogram, tag);
+    range->events++;
+  }
+}
+
+// Function to fill the histogram from the tags of a timestamp range, reading only the indexed blocks that
+// overlap it
+void range_fill_histogram(const struct options *options, int *histogram, struct range_report *report)
+{
+  struct offset_index index;
+  struct block_sampler sampler;
+  struct range_histogram range = {histogram, options->range_start, options->range_end, 0};
+  struct timespec begin;
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  memset(histogram, 0, WINDOW_SIZE * sizeof(int));
+  memset(report, 0, sizeof(*report));
+  report->built = index_open(&index, options->filename, options->index_lines);
+
+  // The sampler only provides the pread buffer and line handling; blocks come from the index
+  block_sampler_open(&sampler, options->filename, index.header.max_block_bytes ? index.header.max_block_bytes : 1,
+                     SAMPLE_ORDER_STRIDED, 1, 0);
+  for (int64_t i = 0; i < index.header.entry_count; i++)
+  {
+    const struct index_entry *entry = &index.entries[i];
+    if (entry->max_timestamp < range.start || entry->min_timestamp >= range.end)
+    {
+      continue;
+    }
+    int64_t end = i + 1 < index.header.entry_count ? index.entries[i + 1].offset : index.header.file_size;
+    block_sampler_read_range(&sampler, entry->offset, end, add_tag_in_range, &range);
+    report->blocks_read++;
+    report->bytes_read += end - entry->offset;
+  }
+
+  report->block_count = index.header.entry_count;
+  report->size = index.header.file_size;
+  report->events = range.events;
+  report->seconds = seconds_since(&begin);
+  block_sampler_close(&sampler);
+  index_free(&index);
+}
+
+void print_range_report(const struct options *options, const struct range_report *report)
+{
+  printf("Range [%lld, %lld) ps: %llu events from %lld of %lld index blocks (%.3f%% of %.1f MB) in %.3f s%s\n",
+         (long long)options->range_start, (long long)options->range_end, (unsigned long long)report->events,
+         (long long)report->blocks_read, (long long)report->block_count,
+         report->size > 0 ? 100.0 * report->bytes_read / report->size : 0.0, report->size / 1e6, report->seconds,
+         report->built ? " (index rebuilt)" : "");
+}
+
+/*
+  Columnar event store
+
+  --store loads the capture once into a structure of arrays (timestamps, channels and the histogram bin of
+  every event) cut into STORE_BLOCK_EVENTS blocks, each with its min/max timestamp and a bitmap of the channels
+  it holds. It then answers queries read from stdin, one per line, without touching the CSV again:
+
+    channels=<c>,<c>...  only these channels, 0 to 62 (default all)
+    range=<a>:<b>        only timestamps in [a, b) ps
+    guard=<ps>           guard band of BER2/V2 (default 100)
+    sweep                also search the optimal guard band
+
+  Blocks outside the range or without a selected channel are skipped, blocks wholly inside the query are
+  binned without a filter, and the rest are filtered four timestamps at a time with AVX2 when available.
+*/
+
+#define STORE_BLOCK_EVENTS 4096 // Events per store block
+#define STORE_CHANNEL_BITS 64   // Channel bitmap width; the last bit stands for every higher channel
+#define MAX_SELECTABLE_CHANNEL (STORE_CHANNEL_BITS - 2) // Highest channel a channel list can name exactly
+
+struct store_block
+{
+  int64_t min_timestamp, max_timestamp;
+  uint64_t channels; // Bit min(channel, 63) is set for every channel in the block
+};
+
+struct event_store
+{
+  int64_t *timestamps;
+  int32_t *channels;
+  uint16_t *bins;     // timestamp mod WINDOW_SIZE
+  size_t count, capacity;
+  struct store_block *blocks;
+  size_t block_count;
+};
+
+struct store_query
+{
+  int64_t start, end;
+  uint64_t channels; // Selected channel bits
+  int guard_band;
+  int sweep;
+};
+
+struct store_query_stats
+{
+  uint64_t events;
+  size_t blocks_scanned, blocks_filtered;
+};
+
+// Function to return the bitmap bit of a channel
+uint64_t store_channel_bit(int32_t channel)
+{
+  return (uint64_t)1 << (channel < 0 ? 0 : channel < STORE_CHANNEL_BITS - 1 ? channel : STORE_CHANNEL_BITS - 1);
+}
+
+// Function to parse a comma-separated channel list into a channel bitmap. Returns 0 for an empty or malformed
+// list, or one naming a channel above MAX_SELECTABLE_CHANNEL (those share the last bitmap bit, so a filter on
+// them could not tell them apart).
+uint64_t parse_channel_list(const char *list)
+{
+  uint64_t channels = 0;
+  const char *p = list;
+  while (*p)
+  {
+    char *next;
+    long channel = strtol(p, &next, 10);
+    if (next == p || channel < 0 || channel > MAX_SELECTABLE_CHANNEL || (*next != ',' && *next != '\0'))
+    {
+      return 0;
+    }
+    channels |= store_channel_bit((int32_t)channel);
+    p = next + (*next == ',');
+  }
+  return channels;
+}
+
+// Function to test a channel against a parsed channel list, where ~0 selects every channel
+int channel_selected(uint64_t channels, int32_t channel)
+{
+  return channels == ~(uint64_t)0 ||
+         (channel >= 0 && channel <= MAX_SELECTABLE_CHANNEL && (channels >> channel & 1));
+}
+
+// Function to load a capture into the columnar store
+void store_load(struct event_store *store, const char *filename)
+{
+  struct csv_reader reader;
+  struct time_tag *tags = malloc(TAG_BLOCK_SIZE * sizeof(struct time_tag));
+  size_t count;
+
+  memset(store, 0, sizeof(*store));
+  csv_reader_open(&reader, filename);
+  while ((count = csv_reader_read(&reader, tags, TAG_BLOCK_SIZE)) > 0)
+  {
+    if (store->count + count > store->capacity)
+    {
+      store->capacity = store->capacity ? 2 * store->capacity : 1 << 20;
+      store->timestamps = realloc(store->timestamps, store->capacity * sizeof(int64_t));
+      store->channels = realloc(store->channels, store->capacity * sizeof(int32_t));
+      store->bins = realloc(store->bins, store->capacity * sizeof(uint16_t));
+      if (!store->timestamps || !store->channels || !store->bins)
+      {
+        printf("Error: Out of memory\n");
+        exit(1);
+      }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+      store->timestamps[store->count + i] = tags[i].timestamp;
+      store->channels[store->count + i] = tags[i].channel;
+      store->bins[store->count + i] = (uint16_t)window_bin(tags[i].timestamp);
+    }
+    store->count += count;
+  }
+  csv_reader_close(&reader);
+  free(tags);
+
+  store->block_count = (store->count + STORE_BLOCK_EVENTS - 1) / STORE_BLOCK_EVENTS;
+  store->blocks = malloc((store->block_count ? store->block_count : 1) * sizeof(struct store_block));
+  if (!store->blocks)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (size_t b = 0; b < store->block_count; b++)
+  {
+    struct store_block *block = &store->blocks[b];
+    size_t end = (b + 1) * STORE_BLOCK_EVENTS < store->count ? (b + 1) * STORE_BLOCK_EVENTS : store->count;
+    block->min_timestamp = INT64_MAX;
+    block->max_timestamp = INT64_MIN;
+    block->channels = 0;
+    for (size_t i = b * STORE_BLOCK_EVENTS; i < end; i++)
+    {
+      block->min_timestamp = store->timestamps[i] < block->min_timestamp ? store->timestamps[i] : block->min_timestamp;
+      block->max_timestamp = store->timestamps[i] > block->max_timestamp ? store->timestamps[i] : block->max_timestamp;
+      block->channels |= store_channel_bit(store->channels[i]);
+    }
+  }
+}
+
+void store_free(struct event_store *store)
+{
+  free(store->timestamps);
+  free(store->channels);
+  free(store->bins);
+  free(store->blocks);
+}
+
+// Function to set keep[i] to 1 for the events of a block that pass the query's range and channel filters
+void store_filter(const int64_t *timestamps, const int32_t *channels, size_t count, const struct store_query *query,
+                  uint8_t *keep)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256i start = _mm256_set1_epi64x(query->start), end = _mm256_set1_epi64x(query->end);
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256i t = _mm256_loadu_si256((const __m256i *)(timestamps + i));
+    // start <= t && t < end, as !(start > t) && end > t
+    __m256i inside = _mm256_andnot_si256(_mm256_cmpgt_epi64(start, t), _mm256_cmpgt_epi64(end, t));
+    int lanes = _mm256_movemask_pd(_mm256_castsi256_pd(inside));
+    for (int k = 0; k < 4; k++)
+    {
+      keep[i + k] = ((lanes >> k) & 1) & (int)((query->channels & store_channel_bit(channels[i + k])) != 0);
+    }
+  }
+#endif
+  for (; i < count; i++)
+  {
+    keep[i] = (timestamps[i] >= query->start) & (timestamps[i] < query->end) &
+              (int)((query->channels & store_channel_bit(channels[i])) != 0);
+  }
+}
+
+// Function to fill the histogram with the events that pass a query, skipping blocks the query excludes
+void store_fill_histogram(const struct event_store *store, const struct store_query *query, int *histogram,
+                          struct store_query_stats *stats)
+{
+  uint8_t keep[STORE_BLOCK_EVENTS];
+
+  memset(histogram, 0, WINDOW_SIZE * sizeof(int));
+  memset(stats, 0, sizeof(*stats));
+  for (size_t b = 0; b < store->block_count; b++)
+  {
+    const struct store_block *block = &store->blocks[b];
+    if (block->max_timestamp < query->start || block->min_timestamp >= query->end ||
+        (block->channels & query->channels) == 0)
+    {
+      continue;
+    }
+    size_t first = b * STORE_BLOCK_EVENTS;
+    size_t count = first + STORE_BLOCK_EVENTS < store->count ? STORE_BLOCK_EVENTS : store->count - first;
+    const uint16_t *bins = store->bins + first;
+    stats->blocks_scanned++;
+
+    if (block->min_timestamp >= query->start && block->max_timestamp < query->end &&
+        (block->channels & ~query->channels) == 0)
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        histogram[bins[i]]++;
+      }
+      stats->events += count;
+      continue;
+    }
+    stats->blocks_filtered++;
+    store_filter(store->timestamps + first, store->channels + first, count, query, keep);
+    for (size_t i = 0; i < count; i++)
+    {
+      histogram[bins[i]] += keep[i];
+      stats->events += keep[i];
+    }
+  }
+}
+
+// Function to parse a query line; returns 0 and prints an error for a malformed query
+int parse_store_query(char *line, struct store_query *query)
+{
+  query->start = INT64_MIN;
+  query->end = INT64_MAX;
+  query->channels = ~(uint64_t)0;
+  query->guard_band = GUARD_BAND;
+  query->sweep = 0;
+
+  for (char *token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n"))
+  {
+    char *p;
+    if (strncmp(token, "channels=", 9) == 0)
+    {
+      query->channels = parse_channel_list(token + 9);
+      if (query->channels == 0)
+      {
+        printf("Error: channels must be a list of channels from 0 to %d\n", MAX_SELECTABLE_CHANNEL);
+        return 0;
+      }
+    }
+    else if (strncmp(token, "range=", 6) == 0)
+    {
+      query->start = strtoll(token + 6, &p, 10);
+      if (*p != ':' || (query->end = strtoll(p + 1, NULL, 10)) <= query->start)
+      {
+        printf("Error: range must be <start>:<end> with start < end\n");
+        return 0;
+      }
+    }
+    else if (strncmp(token, "guard=", 6) == 0)
+    {
+      query->guard_band = atoi(token + 6);
+    }
+    else if (strcmp(token, "sweep") == 0)
+    {
+      query->sweep = 1;
+    }
+    else
+    {
+      printf("Error: Unknown query token %s\n", token);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Function to load the input into the columnar store and answer the queries read from stdin (--store)
+void run_store(const struct options *options)
+{
+  struct event_store store;
+  struct timespec begin;
+  char line[4096];
+  int *histogram = malloc(WINDOW_SIZE * sizeof(int));
+  if (!histogram)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  store_load(&store, options->filename);
+  printf("Store: %zu events in %zu blocks (%.1f MB) loaded in %.3f s\n", store.count, store.block_count,
+         store.count * (sizeof(int64_t) + sizeof(int32_t) + sizeof(uint16_t)) / 1e6, seconds_since(&begin));
+  fflush(stdout);
+
+  while (fgets(line, sizeof(line), stdin))
+  {
+    struct store_query query;
+    struct store_query_stats stats;
+    double BER1, V1, BER2, V2;
+
+    if (!parse_store_query(line, &query))
+    {
+      fflush(stdout);
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    store_fill_histogram(&store, &query, histogram, &stats);
+    int start_index = find_max_sum_window(histogram, WINDOW_SIZE, 3000, &BER1, &V1);
+    apply_guard_bands_and_calculate(histogram, start_index, 3000, &BER2, &V2, query.guard_band);
+    double seconds = seconds_since(&begin);
+    printf("%s,%lf,%lf,%lf,%lf\n", GROUP, BER1, V1, BER2, V2);
+    printf("Query: %llu events, %zu of %zu blocks scanned (%zu filtered) in %.3f ms\n",
+           (unsigned long long)stats.events, stats.blocks_scanned, store.block_count, stats.blocks_filtered,
+           seconds * 1e3);
+    if (query.sweep)
+    {
+      find_optimal_guard_bands(histogram, start_index, 3000, 1, 1);
+    }
+    fflush(stdout);
+  }
+
+  store_free(&store);
+  free(histogram);
+}
+
+/*
+  Analysis daemon
+
+  --daemon <socket> serves analyses over a Unix domain socket so that frequent callers skip process startup
+  and parsing. Each capture is loaded on first request into the columnar store, together with its full
+  histogram and prefix-sum table, and reloaded when its size or modification time changes. Requests and
+  responses are fixed-size structs in host byte order (the socket is local); a request is followed by the
+  capture path. A connection can carry any number of requests. --threads workers accept connections in
+  parallel; captures are shared under a read-write lock. Every capture counts the requests using it, and
+  once the loaded captures exceed --daemon-memory the least recently used idle ones are evicted, so the
+  paths clients send cannot grow the daemon without bound. --connect <socket> sends the request described
+  by the other options and prints the same rows as a local run.
+*/
+
+#define DAEMON_MAGIC 0x51424552 // "QBER"
+#define DAEMON_QUERY 1          // BER/visibility with the request's guard band
+#define DAEMON_QUERY_SWEEP 2    // Also search the optimal guard band
+#define DAEMON_OK 0
+#define DAEMON_BAD_REQUEST 1
+#define DAEMON_NO_CAPTURE 2
+#define DAEMON_BACKLOG 64
+
+struct daemon_request
+{
+  uint32_t magic;
+  uint32_t type;        // DAEMON_QUERY or DAEMON_QUERY_SWEEP
+  int32_t guard_band;
+  uint32_t path_length; // Bytes of capture path following the request
+  int64_t start, end;   // Timestamp range [start, end)
+  uint64_t channels;    // Channel bitmap as in the store, all ones for every channel
+};
+
+struct daemon_response
+{
+  int32_t status;       // DAEMON_OK, DAEMON_BAD_REQUEST or DAEMON_NO_CAPTURE
+  int32_t optimal_BER_guard_band, optimal_visibility_guard_band;
+  uint32_t reserved;
+  uint64_t events;
+  double BER1, V1, BER2, V2;
+  double min_BER, max_visibility;
+  double seconds;       // Time spent by the daemon
+};
+
+struct daemon_capture
+{
+  char *path;
+  pthread_rwlock_t lock;
+  int loaded;
+  int64_t size;           // Size and modification time of the loaded capture
+  struct timespec mtime;
+  struct event_store store;
+  int *histogram;         // Histogram and prefix sums of all events
+  int64_t *prefix;
+  int64_t bytes;          // Memory held by the loaded capture
+  int users;              // Requests between daemon_capture_entry and daemon_capture_release
+  uint64_t last_used;     // Value of the daemon's request counter at the latest request
+  struct daemon_capture *next;
+};
+
+struct analysis_daemon
+{
+  int listen_fd;
+  pthread_mutex_t lock; // Protects the capture list, the users and the memory count
+  struct daemon_capture *captures;
+  int64_t memory, memory_limit;
+  uint64_t requests;
+};
+
+// Function to read exactly size bytes from a socket; returns 0 on end of stream or error
+int recv_all(int fd, void *data, size_t size)
+{
+  char *bytes = data;
+  while (size > 0)
+  {
+    ssize_t received = recv(fd, bytes, size, 0);
+    if (received <= 0)
+    {
+      return 0;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return 1;
+}
+
+// Function to write exactly size bytes to a socket; returns 0 if the peer went away
+int send_all(int fd, const void *data, size_t size)
+{
+  const char *bytes = data;
+  while (size > 0)
+  {
+    ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent <= 0)
+    {
+      return 0;
+    }
+    bytes += sent;
+    size -= sent;
+  }
+  return 1;
+}
+
+// Function to find or add the capture entry of a path and count the caller as a user
+struct daemon_capture *daemon_capture_entry(struct analysis_daemon *daemon, const char *path)
+{
+  pthread_mutex_lock(&daemon->lock);
+  struct daemon_capture *capture = daemon->captures;
+  while (capture && strcmp(capture->path, path) != 0)
+  {
+    capture = capture->next;
+  }
+  if (!capture)
+  {
+    capture = calloc(1, sizeof(*capture));
+    if (!capture || !(capture->path = strdup(path)))
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+    pthread_rwlock_init(&capture->lock, NULL);
+    capture->next = daemon->captures;
+    daemon->captures = capture;
+  }
+  capture->users++;
+  capture->last_used = ++daemon->requests;
+  pthread_mutex_unlock(&daemon->lock);
+  return capture;
+}
+
+void daemon_capture_free(struct daemon_capture *capture)
+{
+  if (capture->loaded)
+  {
+    store_free(&capture->store);
+  }
+  pthread_rwlock_destroy(&capture->lock);
+  free(capture->histogram);
+  free(capture->prefix);
+  free(capture->path);
+  free(capture);
+}
+
+// Function to drop a user of a capture (read-unlocking it if locked), then drop the idle entries of unreadable
+// captures and evict the least recently used idle captures while the loaded ones exceed the memory limit
+void daemon_capture_release(struct analysis_daemon *daemon, struct daemon_capture *capture, int locked)
+{
+  if (locked)
+  {
+    pthread_rwlock_unlock(&capture->lock);
+  }
+  pthread_mutex_lock(&daemon->lock);
+  capture->users--;
+  for (;;)
+  {
+    struct daemon_capture **link = &daemon->captures, **victim = NULL;
+    for (; *link; link = &(*link)->next)
+    {
+      if ((*link)->users == 0 && (!(*link)->loaded || daemon->memory > daemon->memory_limit) &&
+          (!victim || !(*link)->loaded || (*link)->last_used < (*victim)->last_used))
+      {
+        victim = link;
+        if (!(*link)->loaded)
+        {
+          break;
+        }
+      }
+    }
+    if (!victim)
+    {
+      break;
+    }
+    struct daemon_capture *evicted = *victim;
+    *victim = evicted->next;
+    daemon->memory -= evicted->bytes;
+    daemon_capture_free(evicted);
+  }
+  pthread_mutex_unlock(&daemon->lock);
+}
+
+// Function to read-lock a capture, (re)loading it first if it is new or changed on disk.
+// Returns 0 if the file cannot be read.
+int daemon_capture_acquire(struct analysis_daemon *daemon, struct daemon_capture *capture)
+{
+  struct stat info;
+  if (stat(capture->path, &info) != 0 || !S_ISREG(info.st_mode) || access(capture->path, R_OK) != 0)
+  {
+    return 0;
+  }
+
+  pthread_rwlock_rdlock(&capture->lock);
+  if (capture->loaded && capture->size == info.st_size && capture->mtime.tv_sec == info.st_mtim.tv_sec &&
+      capture->mtime.tv_nsec == info.st_mtim.tv_nsec)
+  {
+    return 1;
+  }
+  pthread_rwlock_unlock(&capture->lock);
+
+  pthread_rwlock_wrlock(&capture->lock);
+  if (!(capture->loaded && capture->size == info.st_size && capture->mtime.tv_sec == info.st_mtim.tv_sec &&
+        capture->mtime.tv_nsec == info.st_mtim.tv_nsec))
+  {
+    struct store_query all = {INT64_MIN, INT64_MAX, ~(uint64_t)0, GUARD_BAND, 0};
+    struct store_query_stats stats;
+    if (capture->loaded)
+    {
+      store_free(&capture->store);
+    }
+    store_load(&capture->store, capture->path);
+    if (!capture->histogram)
+    {
+      capture->histogram = malloc(WINDOW_SIZE * sizeof(int));
+      capture->prefix = malloc((WINDOW_SIZE + 1) * sizeof(int64_t));
+      if (!capture->histogram || !capture->prefix)
+      {
+        printf("Error: Out of memory\n");
+        exit(1);
+      }
+    }
+    store_fill_histogram(&capture->store, &all, capture->histogram, &stats);
+    build_prefix_sums(capture->histogram, WINDOW_SIZE, capture->prefix);
+
+    int64_t bytes = capture->store.capacity * (sizeof(int64_t) + sizeof(int32_t) + sizeof(uint16_t)) +
+                    capture->store.block_count * sizeof(struct store_block) + WINDOW_SIZE * sizeof(int) +
+                    (WINDOW_SIZE + 1) * sizeof(int64_t);
+    pthread_mutex_lock(&daemon->lock);
+    daemon->memory += bytes - capture->bytes;
+    pthread_mutex_unlock(&daemon->lock);
+    capture->bytes = bytes;
+    capture->size = info.st_size;
+    capture->mtime = info.st_mtim;
+    capture->loaded = 1;
+  }
+  pthread_rwlock_unlock(&capture->lock);
+  pthread_rwlock_rdlock(&capture->lock);
+  return 1;
+}
+
+// Function to answer one request; histogram is per-thread scratch space
+void daemon_answer(struct analysis_daemon *daemon, const struct daemon_request *request, const char *path,
+                   int *histogram, struct daemon_response *response)
+{
+  struct timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  memset(response, 0, sizeof(*response));
+
+  struct daemon_capture *capture = daemon_capture_entry(daemon, path);
+  if (!daemon_capture_acquire(daemon, capture))
+  {
+    daemon_capture_release(daemon, capture, 0);
+    response->status = DAEMON_NO_CAPTURE;
+    return;
+  }
+
+  // The whole capture is answered from the cached histogram, anything narrower from the store
+  int *analysed = capture->histogram;
+  int start_index;
+  if (request->start == INT64_MIN && request->end == INT64_MAX && request->channels == ~(uint64_t)0)
+  {
+    start_index = find_max_sum_window_prefix(capture->prefix, WINDOW_SIZE, 3000, &response->BER1, &response->V1);
+    response->events = capture->store.count;
+  }
+  else
+  {
+    struct store_query query = {request->start, request->end, request->channels, request->guard_band, 0};
+    struct store_query_stats stats;
+    store_fill_histogram(&capture->store, &query, histogram, &stats);
+    analysed = histogram;
+    start_index = find_max_sum_window(histogram, WINDOW_SIZE, 3000, &response->BER1, &response->V1);
+    response->events = stats.events;
+  }
+  apply_guard_bands_and_calculate(analysed, start_index, 3000, &response->BER2, &response->V2, request->guard_band);
+  if (request->type == DAEMON_QUERY_SWEEP)
+  {
+    int optimal_BER_guard_band, optimal_visibility_guard_band;
+    search_optimal_guard_bands(analysed, start_index, 3000, 1, 1, &optimal_BER_guard_band, &response->min_BER,
+                               &optimal_visibility_guard_band, &response->max_visibility);
+    response->optimal_BER_guard_band = optimal_BER_guard_band;
+    response->optimal_visibility_guard_band = optimal_visibility_guard_band;
+  }
+  daemon_capture_release(daemon, capture, 1);
+  response->seconds = seconds_since(&begin);
+}
+
+// Function to serve connections until the daemon is stopped
+void *daemon_worker_thread(void *argument)
+{
+  struct analysis_daemon *daemon = argument;
+  int *histogram = malloc(WINDOW_SIZE * sizeof(int));
+  char path[4096];
+  if (!histogram)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  for (;;)
+  {
+    int fd = accept(daemon->listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      continue;
+    }
+    struct daemon_request request;
+    struct daemon_response response;
+    while (recv_all(fd, &request, sizeof(request)))
+    {
+      // The last bitmap bit stands for every higher channel, so only "all channels" may set it
+      if (request.magic != DAEMON_MAGIC || request.path_length == 0 || request.path_length >= sizeof(path) ||
+          (request.type != DAEMON_QUERY && request.type != DAEMON_QUERY_SWEEP) ||
+          (request.channels != ~(uint64_t)0 && (request.channels >> (STORE_CHANNEL_BITS - 1)) != 0))
+      {
+        memset(&response, 0, sizeof(response));
+        response.status = DAEMON_BAD_REQUEST;
+        send_all(fd, &response, sizeof(response));
+        break;
+      }
+      if (!recv_all(fd, path, request.path_length))
+      {
+        break;
+      }
+      path[request.path_length] = '\0';
+      daemon_answer(daemon, &request, path, histogram, &response);
+      if (!send_all(fd, &response, sizeof(response)))
+      {
+        break;
+      }
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+// Function to listen on a Unix socket and answer requests with --threads workers (--daemon)
+void run_daemon(const struct options *options)
+{
+  struct analysis_daemon daemon;
+  struct sockaddr_un address;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(options->daemon_socket) >= sizeof(address.sun_path))
+  {
+    printf("Error: Socket path too long: %s\n", options->daemon_socket);
+    exit(1);
+  }
+  strcpy(address.sun_path, options->daemon_socket);
+  unlink(options->daemon_socket); // Left over by a previous daemon
+
+  daemon.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (daemon.listen_fd < 0 || bind(daemon.listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(daemon.listen_fd, DAEMON_BACKLOG) != 0)
+  {
+    printf("Error: Could not listen on %s\n", options->daemon_socket);
+    exit(1);
+  }
+  pthread_mutex_init(&daemon.lock, NULL);
+  daemon.captures = NULL;
+  daemon.memory = 0;
+  daemon.memory_limit = (int64_t)options->daemon_memory_mb << 20;
+  daemon.requests = 0;
+  printf("Daemon: listening on %s with %d threads\n", options->daemon_socket, options->threads);
+  fflush(stdout);
+
+  pthread_t *threads = malloc(options->threads * sizeof(pthread_t));
+  if (!threads)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int t = 0; t < options->threads; t++)
+  {
+    if (pthread_create(&threads[t], NULL, daemon_worker_thread, &daemon) != 0)
+    {
+      printf("Error: Could not start worker thread\n");
+      exit(1);
+    }
+  }
+  for (int t = 0; t < options->threads; t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+}
+
+// Function to send one request to a daemon and print the result like a local run (--connect)
+void run_client(const struct options *options)
+{
+  struct sockaddr_un address;
+  struct daemon_request request;
+  struct daemon_response response;
+  char path[4096];
+
+  if (!realpath(options->filename, path))
+  {
+    printf("Error: Could not open file %s\n", options->filename);
+    exit(1);
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(options->connect_socket) >= sizeof(address.sun_path))
+  {
+    printf("Error: Socket path too long: %s\n", options->connect_socket);
+    exit(1);
+  }
+  strcpy(address.sun_path, options->connect_socket);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    printf("Error: Could not connect to %s\n", options->connect_socket);
+    exit(1);
+  }
+
+  memset(&request, 0, sizeof(request));
+  request.magic = DAEMON_MAGIC;
+  request.type = options->sweep_guard_bands ? DAEMON_QUERY_SWEEP : DAEMON_QUERY;
+  request.guard_band = GUARD_BAND;
+  request.path_length = strlen(path);
+  request.start = options->time_range ? options->range_start : INT64_MIN;
+  request.end = options->time_range ? options->range_end : INT64_MAX;
+  request.channels = options->channels ? parse_channel_list(options->channels) : ~(uint64_t)0;
+  if (request.channels == 0)
+  {
+    printf("Error: --channels must be a list of channels from 0 to %d\n", MAX_SELECTABLE_CHANNEL);
+    exit(1);
+  }
+  if (!send_all(fd, &request, sizeof(request)) || !send_all(fd, path, request.path_length) ||
+      !recv_all(fd, &response, sizeof(response)))
+  {
+    printf("Error: No response from %s\n", options->connect_socket);
+    exit(1);
+  }
+  close(fd);
+
+  if (response.status != DAEMON_OK)
+  {
+    printf("Error: %s\n", response.status == DAEMON_NO_CAPTURE ? "The daemon could not read the capture"
+                                                               : "The daemon rejected the request");
+    exit(1);
+  }
+  printf("%s,%lf,%lf,%lf,%lf\n", GROUP, response.BER1, response.V1, response.BER2, response.V2);
+  if (request.type == DAEMON_QUERY_SWEEP)
+  {
+    print_optimal_guard_bands(response.optimal_BER_guard_band, response.min_BER,
+                              response.optimal_visibility_guard_band, response.max_visibility);
+  }
+}
+
+/*
+  Coincidence counting
+
+  --coincidences <a>,<b> counts pairs of channel-a and channel-b events whose timestamps differ by at most
+  --coincidence-window ps, and histograms the delays t_b - t_a in --coincidence-bin ps bins. The time-ordered
+  stream (use --sort or --reorder for unordered captures) is split into the two channels' timestamps, which
+  are merged in one pass: for every a event a lower pointer into b skips events earlier than t_a - window,
+  and the end of the window is found four timestamps at a time with AVX2 when available. Only the b events
+  still inside the window of an unmatched a event are kept, so memory stays bounded by the event rate.
+*/
+
+// Growable array of one channel's timestamps; events before first have been consumed
+struct timestamp_buffer
+{
+  int64_t *times;
+  size_t first, count, capacity;
+};
+
+void timestamp_buffer_push(struct timestamp_buffer *buffer, int64_t timestamp)
+{
+  if (buffer->count == buffer->capacity)
+  {
+    // Reclaim the consumed prefix before growing
+    if (buffer->first > buffer->count / 2)
+    {
+      memmove(buffer->times, buffer->times + buffer->first, (buffer->count - buffer->first) * sizeof(int64_t));
+      buffer->count -= buffer->first;
+      buffer->first = 0;
+    }
+    else
+    {
+      buffer->capacity = buffer->capacity ? 2 * buffer->capacity : 65536;
+      buffer->times = realloc(buffer->times, buffer->capacity * sizeof(int64_t));
+      if (!buffer->times)
+      {
+        printf("Error: Out of memory\n");
+        exit(1);
+      }
+    }
+  }
+  buffer->times[buffer->count++] = timestamp;
+}
+
+// Function to return the index of the first of times[from, count) that is greater than limit
+size_t first_after(const int64_t *times, size_t from, size_t count, int64_t limit)
+{
+  size_t j = from;
+#if defined(__AVX2__)
+  __m256i bound = _mm256_set1_epi64x(limit);
+  for (; j + 4 <= count; j += 4)
+  {
+    __m256i later = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)(times + j)), bound);
+    int lanes = _mm256_movemask_pd(_mm256_castsi256_pd(later));
+    if (lanes)
+    {
+      return j + __builtin_ctz(lanes);
+    }
+  }
+#endif
+  while (j < count && times[j] <= limit)
+  {
+    j++;
+  }
+  return j;
+}
+
+// Function to match the sorted timestamps a[0, na) against the sorted b[0, nb): every pair with
+// min_delay <= t_b - t_a <= max_delay adds to delays bin (t_b - t_a - min_delay) / bin_width. Returns the pairs.
+uint64_t match_coincidences(const int64_t *a, size_t na, const int64_t *b, size_t nb, int64_t min_delay,
+                            int64_t max_delay, int64_t bin_width, uint64_t *delays)
+{
+  uint64_t pairs = 0;
+  size_t low = 0;
+  for (size_t i = 0; i < na; i++)
+  {
+    while (low < nb && b[low] < a[i] + min_delay)
+    {
+      low++;
+    }
+    size_t high = first_after(b, low, nb, a[i] + max_delay);
+    for (size_t j = low; j < high; j++)
+    {
+      delays[(b[j] - a[i] - min_delay) / bin_width]++;
+    }
+    pairs += high - low;
+  }
+  return pairs;
+}
+
+// Function to print the coincidence summary and write the delay histogram as "delay_ps,count" rows
+void print_coincidences(const struct options *options, uint64_t pairs, uint64_t singles_a, uint64_t singles_b,
+                        int64_t span, const uint64_t *delays, size_t bins, uint64_t events, double seconds)
+{
+  int64_t window = options->coincidence_window;
+  // Pairs expected from uncorrelated events: rate_a * rate_b * (2 * window + 1) * span
+  double accidentals = span > 0 ? (double)singles_a * singles_b * (2 * window + 1) / span : 0;
+  printf("Coincidences %d,%d within +-%lld ps: %llu pairs (singles %llu, %llu; accidentals %.1f, CAR %.2f); "
+         "%llu events in %.3f s (%.1f M events/s)\n",
+         options->coincidence_a, options->coincidence_b, (long long)window, (unsigned long long)pairs,
+         (unsigned long long)singles_a, (unsigned long long)singles_b, accidentals,
+         accidentals > 0 ? pairs / accidentals : 0.0, (unsigned long long)events, seconds,
+         seconds > 0 ? events / seconds / 1e6 : 0.0);
+
+  FILE *output = stdout;
+  if (options->coincidence_output)
+  {
+    output = fopen(options->coincidence_output, "w");
+    if (!output)
+    {
+      printf("Error: Could not create file %s\n", options->coincidence_output);
+      exit(1);
+    }
+  }
+  fprintf(output, "delay_ps,count\n");
+  for (size_t k = 0; k < bins; k++)
+  {
+    fprintf(output, "%lld,%llu\n", (long long)((int64_t)k * options->coincidence_bin - window), (unsigned long long)delays[k]);
+  }
+  if (output != stdout)
+  {
+    fclose(output);
+  }
+}
+
+// Function to count the coincidences of two channels in one pass over the time-ordered input (--coincidences)
+void run_coincidences(const struct options *options)
+{
+  struct ingest ingest;
+  struct time_tag tags[TAG_BLOCK_SIZE];
+  struct timestamp_buffer a = {0}, b = {0};
+  struct timespec begin;
+  int64_t window = options->coincidence_window, first_time = 0, last_time = INT64_MIN;
+  size_t bins = (size_t)(2 * window / options->coincidence_bin + 1);
+  uint64_t pairs = 0, events = 0, singles_a = 0, singles_b = 0;
+  size_t count;
+
+  uint64_t *delays = calloc(bins, sizeof(uint64_t));
+  if (!delays)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  ingest_open(&ingest, options);
+  while ((count = ingest.source->read(ingest.source->context, tags, TAG_BLOCK_SIZE)) > 0)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      if (tags[i].timestamp < last_time)
+      {
+        printf("Error: Timestamps are not in time order; use --sort or --reorder <ps>\n");
+        exit(1);
+      }
+      if (events++ == 0)
+      {
+        first_time = tags[i].timestamp;
+      }
+      last_time = tags[i].timestamp;
+      if (tags[i].channel == options->coincidence_a)
+      {
+        timestamp_buffer_push(&a, tags[i].timestamp);
+        singles_a++;
+      }
+      else if (tags[i].channel == options->coincidence_b)
+      {
+        timestamp_buffer_push(&b, tags[i].timestamp);
+        singles_b++;
+      }
+    }
+
+    // An a event is complete once the stream has passed the end of its window
+    size_t ready = first_after(a.times, a.first, a.count, last_time - window - 1);
+    pairs += match_coincidences(a.times + a.first, ready - a.first, b.times + b.first, b.count - b.first, -window,
+                                window, options->coincidence_bin, delays);
+    a.first = ready;
+    int64_t keep_from = a.first < a.count ? a.times[a.first] - window : last_time - window;
+    b.first = first_after(b.times, b.first, b.count, keep_from - 1);
+  }
+  pairs += match_coincidences(a.times + a.first, a.count - a.first, b.times + b.first, b.count - b.first, -window,
+                              window, options->coincidence_bin, delays);
+  ingest_close(&ingest);
+
+  print_coincidences(options, pairs, singles_a, singles_b, events ? last_time - first_time : 0, delays, bins, events,
+                     seconds_since(&begin));
+  free(delays);
+  free(a.times);
+  free(b.times);
+}
+
+/*
+  Heralded analysis
+
+  With --herald <channel> only signal events (every other channel, or the --channels list) that have a herald
+  within --herald-window ps are binned, so uncorrelated dark counts no longer dilute the visibility. The two
+  channels are joined as one stream: every thread streams one byte range (a time chunk) of a time-ordered
+  capture and keeps only the time of its last herald and the signals of the last window that a later herald
+  may still match, so memory does not grow with the capture. Signals left unmatched within a window of a
+  chunk's edges are resolved after the join against the last herald before and the first herald after the
+  chunk. With --sort, --reorder or --counter-bits the stream comes from the ingest pipeline as one chunk.
+*/
+
+struct herald_stream
+{
+  const struct options *options;
+  int64_t start, end;                // Byte range, or start < 0 for the ingest pipeline
+  uint64_t channels;                 // Signal channel bitmap
+  int *histogram;
+  uint64_t events, heralds, signals, matched;
+  int64_t first_time, last_time;     // First and last timestamp of the chunk
+  int64_t first_herald, last_herald; // First and last herald of the chunk
+  struct timestamp_buffer pending;   // Signals that a later herald of the chunk may still match
+  struct timestamp_buffer edges;     // Unmatched signals within a window of the chunk's edges
+  int ordered;                       // 0 if the chunk is not in time order
+};
+
+struct herald_report
+{
+  uint64_t heralds, signals, matched;
+  int chunks, threads;
+  double seconds;
+};
+
+// Function to stream one chunk, a byte range or the whole ingest pipeline, into a block consumer
+void read_time_chunk(const struct options *options, int64_t start, int64_t end,
+                       void (*add)(void *, const struct time_tag *, size_t), void *context)
+{
+  struct time_tag tags[TAG_BLOCK_SIZE];
+  size_t count;
+
+  if (start < 0)
+  {
+    struct ingest ingest;
+    ingest_open(&ingest, options);
+    while ((count = ingest.source->read(ingest.source->context, tags, TAG_BLOCK_SIZE)) > 0)
+    {
+      add(context, tags, count);
+    }
+    ingest_close(&ingest);
+  }
+  else
+  {
+    struct csv_reader reader;
+    csv_reader_open_range(&reader, options->filename, start, end);
+    while ((count = csv_reader_read(&reader, tags, TAG_BLOCK_SIZE)) > 0)
+    {
+      add(context, tags, count);
+    }
+    csv_reader_close(&reader);
+  }
+}
+
+// Function to bin a signal that has a herald within the window
+void herald_stream_match(struct herald_stream *stream, int64_t timestamp)
+{
+  stream->histogram[window_bin(timestamp)]++;
+  stream->matched++;
+}
+
+// Function to drop the pending signals earlier than limit, which no later herald of the chunk can match. Those
+// within a window of the chunk's start are kept for the heralds of the chunks before.
+void herald_stream_expire(struct herald_stream *stream, int64_t limit)
+{
+  struct timestamp_buffer *pending = &stream->pending;
+  while (pending->first < pending->count && pending->times[pending->first] < limit)
+  {
+    int64_t timestamp = pending->times[pending->first++];
+    if (timestamp - stream->options->herald_window <= stream->first_time)
+    {
+      timestamp_buffer_push(&stream->edges, timestamp);
+    }
+  }
+}
+
+// Function to join a parsed stream of heralds and signals, checking time order
+void herald_stream_add(void *context, const struct time_tag *tags, size_t count)
+{
+  struct herald_stream *stream = context;
+  struct timestamp_buffer *pending = &stream->pending;
+  int64_t window = stream->options->herald_window;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    int64_t t = tags[i].timestamp;
+    if (stream->events++ == 0)
+    {
+      stream->first_time = t;
+    }
+    stream->ordered &= t >= stream->last_time;
+    stream->last_time = t;
+    herald_stream_expire(stream, t - window);
+    if (tags[i].channel == stream->options->herald)
+    {
+      if (stream->heralds++ == 0)
+      {
+        stream->first_herald = t;
+      }
+      stream->last_herald = t;
+
+      // Every signal still pending is within the window of this herald
+      while (pending->first < pending->count)
+      {
+        herald_stream_match(stream, pending->times[pending->first++]);
+      }
+      pending->first = pending->count = 0;
+    }
+    else if (channel_selected(stream->channels, tags[i].channel))
+    {
+      stream->signals++;
+      if (stream->heralds && stream->last_herald >= t - window)
+      {
+        herald_stream_match(stream, t);
+      }
+      else
+      {
+        timestamp_buffer_push(pending, t);
+      }
+    }
+  }
+}
+
+void *herald_stream_thread(void *argument)
+{
+  struct herald_stream *stream = argument;
+  stream->ordered = 1;
+  stream->last_time = INT64_MIN;
+  read_time_chunk(stream->options, stream->start, stream->end, herald_stream_add, stream);
+
+  // The signals still pending are within a window of the chunk's end
+  for (size_t i = stream->pending.first; i < stream->pending.count; i++)
+  {
+    timestamp_buffer_push(&stream->edges, stream->pending.times[i]);
+  }
+  free(stream->pending.times);
+  return NULL;
+}
+
+// Function to fill the histogram with the signal events that have a herald within the window
+void heralded_fill_histogram(const struct options *options, int *histogram, struct herald_report *report)
+{
+  struct timespec begin;
+  struct stat info;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  memset(report, 0, sizeof(*report));
+
+  uint64_t channels = options->channels ? parse_channel_list(options->channels) : ~(uint64_t)0;
+  if (!channels)
+  {
+    printf("Error: --channels must be a list of channels from 0 to %d\n", MAX_SELECTABLE_CHANNEL);
+    exit(1);
+  }
+  if (stat(options->filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", options->filename);
+    exit(1);
+  }
+
+  // Join the time chunks in parallel, or one chunk through the pipeline when it reorders or unwraps
+  int pipeline = options->external_sort || options->reorder_horizon > 0 || options->counter_bits > 0;
+  int chunk_count = pipeline ? 1 : options->threads;
+  struct herald_stream *streams = calloc(chunk_count, sizeof(struct herald_stream));
+  int *copies = calloc((size_t)chunk_count * WINDOW_SIZE, sizeof(int));
+  int64_t *next_herald = malloc(chunk_count * sizeof(int64_t));
+  pthread_t *threads = malloc(chunk_count * sizeof(pthread_t));
+  if (!streams || !copies || !next_herald || !threads)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int c = 0; c < chunk_count; c++)
+  {
+    streams[c].options = options;
+    streams[c].channels = channels;
+    streams[c].histogram = copies + (size_t)c * WINDOW_SIZE;
+    streams[c].start = pipeline ? -1 : info.st_size * c / chunk_count;
+    streams[c].end = c + 1 == chunk_count ? INT64_MAX : info.st_size * (c + 1) / chunk_count;
+    pthread_create(&threads[c], NULL, herald_stream_thread, &streams[c]);
+  }
+  memset(histogram, 0, WINDOW_SIZE * sizeof(int));
+  int64_t last_time = INT64_MIN;
+  for (int c = 0; c < chunk_count; c++)
+  {
+    pthread_join(threads[c], NULL);
+    if (!streams[c].ordered || (streams[c].events && streams[c].first_time < last_time))
+    {
+      printf("Error: Timestamps are not in time order; use --sort or --reorder <ps>\n");
+      exit(1);
+    }
+    if (streams[c].events)
+    {
+      last_time = streams[c].last_time;
+    }
+    add_histograms(histogram, streams[c].histogram, WINDOW_SIZE);
+    report->heralds += streams[c].heralds;
+    report->signals += streams[c].signals;
+    report->matched += streams[c].matched;
+  }
+
+  // Match the signals near the chunk edges against the last herald before and the first herald after the chunk
+  for (int c = chunk_count - 1; c >= 0; c--)
+  {
+    next_herald[c] = c + 1 == chunk_count ? INT64_MAX
+                     : streams[c + 1].heralds ? streams[c + 1].first_herald
+                                               : next_herald[c + 1];
+  }
+  struct herald_stream edges = {.options = options, .histogram = histogram};
+  int have_previous = 0;
+  int64_t previous_herald = 0;
+  for (int c = 0; c < chunk_count; c++)
+  {
+    for (size_t i = 0; i < streams[c].edges.count; i++)
+    {
+      int64_t t = streams[c].edges.times[i];
+      if ((have_previous && previous_herald >= t - options->herald_window) ||
+          next_herald[c] <= t + options->herald_window)
+      {
+        herald_stream_match(&edges, t);
+      }
+    }
+    if (streams[c].heralds)
+    {
+      have_previous = 1;
+      previous_herald = streams[c].last_herald;
+    }
+    free(streams[c].edges.times);
+  }
+  report->matched += edges.matched;
+
+  report->chunks = chunk_count;
+  report->threads = chunk_count;
+  report->seconds = seconds_since(&begin);
+  free(copies);
+  free(next_herald);
+  free(streams);
+  free(threads);
+  if (report->matched == 0)
+  {
+    printf("Error: No heralded events: no signal within +-%lld ps of a herald on channel %d\n",
+           (long long)options->herald_window, options->herald);
+    exit(1);
+  }
+}
+
+void print_herald_report(const struct options *options, const struct herald_report *report)
+{
+  printf("Heralded: %llu of %llu signal events within +-%lld ps of %llu heralds on channel %d (%.1f%%); "
+         "%d chunks, %d threads, %.3f s\n",
+         (unsigned long long)report->matched, (unsigned long long)report->signals,
+         (long long)options->herald_window, (unsigned long long)report->heralds, options->herald,
+         report->signals ? 100.0 * report->matched / report->signals : 0.0, report->chunks, report->threads,
+         report->seconds);
+}
+
+/*
+  Second-order correlation g2(tau)
+
+  --g2 <a>,<b> histograms the delays tau = t_b - t_a of all channel pairs with min <= tau < max (--g2-range),
+  in --g2-bin ps bins, and normalizes each bin by the count expected from uncorrelated detectors:
+  g2(tau) = N(tau) * T / (N_a * N_b * bin), with T the time span of the two channels. The capture is parsed in
+  parallel time chunks into the two channels' sorted timestamps; the chunks' arrays are joined so that pairs
+  across chunk boundaries are kept. Both arrays stay in memory, 8 bytes per event of the two channels, so unlike
+  the streaming herald path the memory grows with the capture. Every thread then slides a pointer window over
+  the b events for its share of the a events, so the cost is the number of events times the mean number of b
+  events per tau range.
+*/
+
+struct channel_pair_chunk
+{
+  const struct options *options;
+  int64_t start, end;                // Byte range, or start < 0 for the ingest pipeline
+  int32_t channel_a, channel_b;
+  struct timestamp_buffer a, b;      // Timestamps of the two channels
+  int64_t last_time;
+  int ordered;                       // 0 if the chunk is not in time order
+};
+
+// Function to split a parsed stream into the timestamps of the two channels, checking time order
+void channel_pair_add(void *context, const struct time_tag *tags, size_t count)
+{
+  struct channel_pair_chunk *chunk = context;
+  for (size_t i = 0; i < count; i++)
+  {
+    chunk->ordered &= tags[i].timestamp >= chunk->last_time;
+    chunk->last_time = tags[i].timestamp;
+    if (tags[i].channel == chunk->channel_a)
+    {
+      timestamp_buffer_push(&chunk->a, tags[i].timestamp);
+    }
+    else if (tags[i].channel == chunk->channel_b)
+    {
+      timestamp_buffer_push(&chunk->b, tags[i].timestamp);
+    }
+  }
+}
+
+void *channel_pair_thread(void *argument)
+{
+  struct channel_pair_chunk *chunk = argument;
+  chunk->ordered = 1;
+  chunk->last_time = INT64_MIN;
+  read_time_chunk(chunk->options, chunk->start, chunk->end, channel_pair_add, chunk);
+  return NULL;
+}
+
+// Function to concatenate the chunks' arrays of channel a or b; exits if the chunks are not in time order
+int64_t *channel_pair_concatenate(struct channel_pair_chunk *chunks, int chunk_count, int second, size_t *total)
+{
+  *total = 0;
+  for (int c = 0; c < chunk_count; c++)
+  {
+    struct timestamp_buffer *buffer = second ? &chunks[c].b : &chunks[c].a;
+    *total += buffer->count;
+  }
+  int64_t *times = malloc((*total ? *total : 1) * sizeof(int64_t));
+  if (!times)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  size_t offset = 0;
+  for (int c = 0; c < chunk_count; c++)
+  {
+    struct timestamp_buffer *buffer = second ? &chunks[c].b : &chunks[c].a;
+    memcpy(times + offset, buffer->times, buffer->count * sizeof(int64_t));
+    offset += buffer->count;
+  }
+  for (size_t i = 1; i < *total; i++)
+  {
+    if (times[i] < times[i - 1])
+    {
+      printf("Error: Timestamps are not in time order; use --sort or --reorder <ps>\n");
+      exit(1);
+    }
+  }
+  return times;
+}
+
+// Function to parse the input in parallel time chunks into the sorted timestamps of channels a and b. Both
+// arrays are held in memory, 8 bytes per event. Returns the number of chunks.
+int parse_channel_pair(const struct options *options, int32_t channel_a, int32_t channel_b, int64_t **a,
+                       size_t *a_count, int64_t **b, size_t *b_count)
+{
+  struct stat info;
+  if (stat(options->filename, &info) != 0)
+  {
+    printf("Error: Could not open file %s\n", options->filename);
+    exit(1);
+  }
+
+  // One chunk through the pipeline when it reorders or unwraps
+  int pipeline = options->external_sort || options->reorder_horizon > 0 || options->counter_bits > 0;
+  int chunk_count = pipeline ? 1 : options->threads;
+  struct channel_pair_chunk *chunks = calloc(chunk_count, sizeof(struct channel_pair_chunk));
+  pthread_t *threads = malloc(chunk_count * sizeof(pthread_t));
+  if (!chunks || !threads)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int c = 0; c < chunk_count; c++)
+  {
+    chunks[c].options = options;
+    chunks[c].channel_a = channel_a;
+    chunks[c].channel_b = channel_b;
+    chunks[c].start = pipeline ? -1 : info.st_size * c / chunk_count;
+    chunks[c].end = c + 1 == chunk_count ? INT64_MAX : info.st_size * (c + 1) / chunk_count;
+    pthread_create(&threads[c], NULL, channel_pair_thread, &chunks[c]);
+  }
+  for (int c = 0; c < chunk_count; c++)
+  {
+    pthread_join(threads[c], NULL);
+    if (!chunks[c].ordered)
+    {
+      printf("Error: Timestamps are not in time order; use --sort or --reorder <ps>\n");
+      exit(1);
+    }
+  }
+
+  *a = channel_pair_concatenate(chunks, chunk_count, 0, a_count);
+  *b = channel_pair_concatenate(chunks, chunk_count, 1, b_count);
+  for (int c = 0; c < chunk_count; c++)
+  {
+    free(chunks[c].a.times);
+    free(chunks[c].b.times);
+  }
+  free(threads);
+  free(chunks);
+  return chunk_count;
+}
+
+struct g2_share
+{
+  const int64_t *a, *b;
+  size_t first, last;  // Share of the a events
+  size_t b_count;
+  int64_t min_delay, max_delay, bin_width;
+  uint64_t *delays;
+  uint64_t pairs;
+};
+
+void *g2_thread(void *argument)
+{
+  struct g2_share *share = argument;
+  if (share->first < share->last)
+  {
+    // Binary search for the first b event of the first a event's range
+    size_t low = 0, high = share->b_count;
+    int64_t earliest = share->a[share->first] + share->min_delay;
+    while (low < high)
+    {
+      size_t middle = low + (high - low) / 2;
+      if (share->b[middle] < earliest)
+      {
+        low = middle + 1;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+    share->pairs = match_coincidences(share->a + share->first, share->last - share->first, share->b + low,
+                                      share->b_count - low, share->min_delay, share->max_delay, share->bin_width,
+                                      share->delays);
+  }
+  return NULL;
+}
+
+// Function to compute and print g2(tau) of two channels (--g2)
+void run_g2(const struct options *options)
+{
+  struct timespec begin;
+  int64_t *a, *b;
+  size_t a_count, b_count;
+  int64_t min_delay = options->g2_min, max_delay = options->g2_max, bin_width = options->g2_bin;
+  int bins = (int)((max_delay - min_delay) / bin_width + ((max_delay - min_delay) % bin_width != 0));
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  int chunk_count = parse_channel_pair(options, options->g2_a, options->g2_b, &a, &a_count, &b, &b_count);
+
+  struct g2_share *shares = calloc(options->threads, sizeof(struct g2_share));
+  uint64_t *delays = calloc((size_t)options->threads * bins, sizeof(uint64_t));
+  pthread_t *threads = malloc(options->threads * sizeof(pthread_t));
+  if (!shares || !delays || !threads)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+  for (int t = 0; t < options->threads; t++)
+  {
+    shares[t] = (struct g2_share){a, b, a_count * t / options->threads, a_count * (t + 1) / options->threads,
+                                  b_count, min_delay, max_delay - 1, bin_width, delays + (size_t)t * bins, 0};
+    pthread_create(&threads[t], NULL, g2_thread, &shares[t]);
+  }
+  uint64_t pairs = 0;
+  for (int t = 0; t < options->threads; t++)
+  {
+    pthread_join(threads[t], NULL);
+    pairs += shares[t].pairs;
+    if (t > 0)
+    {
+      for (int k = 0; k < bins; k++)
+      {
+        delays[k] += shares[t].delays[k];
+      }
+    }
+  }
+
+  int64_t span = 0;
+  if (a_count > 0 && b_count > 0)
+  {
+    int64_t first = a[0] < b[0] ? a[0] : b[0], last = a[a_count - 1] > b[b_count - 1] ? a[a_count - 1] : b[b_count - 1];
+    span = last - first;
+  }
+  double expected = span > 0 ? (double)a_count * b_count * bin_width / span : 0;
+  printf("g2 %d,%d over [%lld, %lld) ps in %lld ps bins: %llu pairs (singles %zu, %zu; %.1f expected per bin); "
+         "%d chunks, %d threads, %.3f s\n",
+         options->g2_a, options->g2_b, (long long)min_delay, (long long)max_delay, (long long)bin_width,
+         (unsigned long long)pairs, a_count, b_count, expected, chunk_count, options->threads, seconds_since(&begin));
+
+  FILE *output = stdout;
+  if (options->g2_output)
+  {
+    output = fopen(options->g2_output, "w");
+    if (!output)
+    {
+      printf("Error: Could not create file %s\n", options->g2_output);
+      exit(1);
+    }
+  }
+  fprintf(output, "tau_ps,count,g2\n");
+  for (int k = 0; k < bins; k++)
+  {
+    // The last bin is narrower when the bin width does not divide the range
+    int64_t low = min_delay + k * bin_width, width = max_delay - low < bin_width ? max_delay - low : bin_width;
+    double bin_expected = expected * width / bin_width;
+    fprintf(output, "%lld,%llu,%lf\n", (long long)low, (unsigned long long)delays[k],
+            bin_expected > 0 ? delays[k] / bin_expected : 0.0);
+  }
+  if (output != stdout)
+  {
+    fclose(output);
+  }
+
+  free(threads);
+  free(delays);
+  free(shares);
+  free(a);
+  free(b);
+}
+
+// Function to sum the input snapshots into the merge output, return the combined histogram and its resolution
+int merge_snapshot_files(const struct options *options, int *histogram)
+{
+  struct histogram_snapshot merged, next;
+
+  snapshot_load(&merged, options->inputs[0]);
+  for (int i = 1; i < options->input_count; i++)
+  {
+    snapshot_load(&next, options->inputs[i]);
+    snapshot_merge(&merged, &next);
+    snapshot_free(&next);
+  }
+  snapshot_rebin(&merged, options->resolution);
+  snapshot_save(&merged, options->merge_output);
+  snapshot_combined_histogram(&merged, histogram);
+  snapshot_free(&merged);
+  return merged.header.resolution;
+}
+
+// Function to ingest the capture into per-channel histograms, save and/or cache them and return the combined histogram
+void ingest_into_snapshot(struct ingest *ingest, const struct options *options, uint64_t fingerprint, int *histogram)
+{
+  struct histogram_snapshot snapshot;
+
+  snapshot_init(&snapshot, WINDOW_SIZE / options->resolution, options->resolution);
+  snapshot.header.fingerprint = fingerprint;
+  fill_snapshot_from_source(ingest->source, &snapshot);
+  if (options->save_snapshot)
+  {
+    snapshot_save(&snapshot, options->save_snapshot);
+  }
+  snapshot_combined_histogram(&snapshot, histogram);
+
+  if (cache_usable(options))
+  {
+    int64_t *prefix = malloc((snapshot.header.period + 1) * sizeof(int64_t));
+    if (!prefix)
+    {
+      printf("Error: Out of memory\n");
+      exit(1);
+    }
+    build_prefix_sums(histogram, snapshot.header.period, prefix);
+    cache_store(options, cache_key(options->filename, fingerprint, options), &snapshot, prefix);
+    free(prefix);
+  }
+  snapshot_free(&snapshot);
+}
+
+int main(int argc, char *argv[])
+{
+  struct options options;
+  parse_options(argc, argv, &options);
+
+  if (options.benchmark_fill)
+  {
+    run_fill_benchmark();
+    free(options.inputs);
+    return 0;
+  }
+  if (options.check_binomial)
+  {
+    int status = check_random_binomial();
+    free(options.inputs);
+    return status;
+  }
+  if (options.daemon_socket)
+  {
+    run_daemon(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.connect_socket)
+  {
+    run_client(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.g2)
+  {
+    run_g2(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.coincidences)
+  {
+    run_coincidences(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.store)
+  {
+    run_store(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.build_index)
+  {
+    run_build_index(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.batch)
+  {
+    run_batch(&options);
+    free(options.inputs);
+    return 0;
+  }
+  if (options.tail_state)
+  {
+    run_incremental(&options);
+    free(options.inputs);
+    return 0;
+  }
+
+  int *histogram = malloc((size_t)WINDOW_SIZE * options.subps * sizeof(int));
+  static int64_t prefix_table[WINDOW_SIZE + 1];
+  int64_t *prefix = NULL; // Set when a cached prefix-sum table is available
+  if (!histogram)
+  {
+    printf("Error: Out of memory\n");
+    exit(1);
+  }
+
+  // Process the CSV file (or snapshot) and populate the histogram
+  struct ingest ingest;
+  struct histogram_snapshot snapshot;
+  struct shard_report shards;
+  struct sample_report sampling;
+  struct preview_report preview;
+  struct range_report range;
+  struct herald_report heralding;
+  static struct numa_node nodes[MAX_NUMA_NODES];
+  int node_count = 0;
+  int ingesting = 0, cached = 0;
+  int resolution = 1; // ps per bin of the histogram as built
+  uint64_t fingerprint = 0;
+  if (!options.merge_output && cache_usable(&options) && !is_snapshot_file(options.filename))
+  {
+    fingerprint = file_fingerprint(options.filename);
+    cached = cache_lookup(&options, cache_key(options.filename, fingerprint, &options), fingerprint, &snapshot, prefix_table);
+  }
+
+  if (options.merge_output)
+  {
+    resolution = merge_snapshot_files(&options, histogram);
+  }
+  else if (is_snapshot_file(options.filename))
+  {
+    snapshot_load(&snapshot, options.filename);
+    resolution = snapshot.header.resolution;
+    snapshot_combined_histogram(&snapshot, histogram);
+    snapshot_free(&snapshot);
+  }
+  else if (cached)
+  {
+    // Cache hit: no ingestion at all
+    if (options.save_snapshot)
+    {
+      snapshot_save(&snapshot, options.save_snapshot);
+    }
+    snapshot_combined_histogram(&snapshot, histogram);
+    snapshot_free(&snapshot);
+    prefix = prefix_table;
+    resolution = options.resolution;
+  }
+  else if (options.preview)
+  {
+    preview_fill_histogram(&options, histogram, &preview);
+  }
+  else if (options.time_range)
+  {
+    range_fill_histogram(&options, histogram, &range);
+  }
+  else if (options.herald >= 0)
+  {
+    heralded_fill_histogram(&options, histogram, &heralding);
+  }
+  else if (options.target_precision > 0)
+  {
+    sampled_fill_histogram(&options, histogram, &sampling);
+  }
+  else if (options.numa)
+  {
+    numa_fill_histogram(&options, histogram, nodes, &node_count);
+  }
+  else if (options.processes > 1)
+  {
+    sharded_fill_histogram(&options, histogram, &shards);
+  }
+  else if (ingest_needed(&options))
+  {
+    ingesting = 1;
+    ingest_open(&ingest, &options);
+    if (options.subps > 1)
+    {
+      fill_subps_histogram_from_source(ingest.source, histogram, options.subps);
+    }
+    else if (options.save_snapshot || cache_usable(&options))
+    {
+      ingest_into_snapshot(&ingest, &options, fingerprint ? fingerprint : file_fingerprint(options.filename), histogram);
+      resolution = options.resolution;
+    }
+    else
+    {
+      fill_histogram_from_source(ingest.source, histogram);
+    }
+  }
+  else
+  {
+    process_csv_and_create_histogram(options.filename, histogram);
+  }
+
+  // Coarser analysis requested (--resolution): exact rebinning, a snapshot is never refined
+  if (options.resolution > resolution && options.resolution % resolution == 0)
+  {
+    rebin_histogram(histogram, WINDOW_SIZE / resolution, options.resolution / resolution, histogram);
+    resolution = options.resolution;
+  }
+  int bins = WINDOW_SIZE / resolution * options.subps, window_size = 3000 / resolution * options.subps;
+
+  double BER1, V1, BER2, V2;
+
+  // Find the 3ns window with the maximum sum and calculate BER1 and Visibility1
+  int start_index = prefix ? find_max_sum_window_prefix(prefix, bins, window_size, &BER1, &V1)
+                          : find_max_sum_window(histogram, bins, window_size, &BER1, &V1);
+
+  // Apply guard bands and calculate BER2 and Visibility2
+  apply_guard_bands_at_resolution(histogram, start_index, window_size, &BER2, &V2, GUARD_BAND, resolution, options.subps);
+
+  // Output the results
+  printf("%s,%lf,%lf,%lf,%lf\n", GROUP, BER1, V1, BER2, V2);
+  if (resolution > 1)
+  {
+    report_resolution_error(histogram, bins, start_index, window_size, resolution, GUARD_BAND);
+  }
+  if (options.confidence > 0)
+  {
+    struct window_counts counts;
+    count_window_events(histogram, start_index, window_size, GUARD_BAND, resolution, options.subps, &counts);
+    report_confidence_intervals(&counts, options.confidence, options.bootstrap, options.threads, options.seed);
+  }
+
+  if (ingesting)
+  {
+    ingest_close(&ingest);
+  }
+  if (options.preview && !is_snapshot_file(options.filename))
+  {
+    print_preview_report(&preview);
+  }
+  else if (options.time_range && !is_snapshot_file(options.filename))
+  {
+    print_range_report(&options, &range);
+  }
+  else if (options.herald >= 0 && !is_snapshot_file(options.filename))
+  {
+    print_herald_report(&options, &heralding);
+  }
+  else if (options.target_precision > 0 && !is_snapshot_file(options.filename))
+  {
+    print_sample_report(&sampling);
+  }
+  else if (options.numa && !is_snapshot_file(options.filename))
+  {
+    print_numa_report(nodes, node_count);
+  }
+  else if (options.processes > 1 && !is_snapshot_file(options.filename))
+  {
+    print_shard_report(&shards);
+  }
+
+  // Find the optimal guard band (--sweep-guard-bands)
+  if (options.sweep_guard_bands)
+  {
+    find_optimal_guard_bands(histogram, start_index, window_size, resolution, options.subps);
+  }
+  free(histogram);
+  free(options.inputs);
   return 0;
 }